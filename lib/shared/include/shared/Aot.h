@@ -0,0 +1,176 @@
+#pragma once
+
+#include <shared/Debug.h>
+#include <shared/Object.h>
+#include <shared/VM.h>
+
+// Runtime support for the C code loxc generates from a Chunk. Each instruction becomes one of the AOT_ macros below, which expect two locals:
+// sp, the stack top (written back to VM::stackTop before anything that can allocate, print or fail), and k, the Constant Pool.
+// Allocating macros start with a gcSafePoint(), and read their operands from the stack after it, since a collection can move them.
+// Stores into globals go through globalWriteBarrier(), with the Value they overwrite, for major collections.
+// The macros do what the matching case of run() does, with the same error messages, but the line of each instruction is baked in.
+
+/**
+ * @brief Fills the Chunk a compiled program runs with: its Constant Pool, its maxStack, and the slots of its globals.
+ * @param chunk The Chunk to fill. It has no code, the code is the compiled C.
+ */
+typedef void (*AotLoader)(Chunk* chunk);
+
+/**
+ * @brief The compiled code of a program.
+ * @param sp The stack top to start with.
+ * @param k The Constant Pool filled by the AotLoader.
+ * @return The result of running the program.
+ */
+typedef InterpretResult (*AotScript)(Value* sp, Value* k);
+
+/**
+ * @brief Runs a program compiled by loxc. Called from the main() it generates.
+ * @param load Loads the program's constants and globals.
+ * @param script The program.
+ * @return The exit code of the program: 0, or EX_SOFTWARE after a runtime error, like lox.
+ */
+int runAot(AotLoader load, AotScript script);
+
+/**
+ * @brief Reinterpret bits as a double. Constants that are not finite have no C literal, loxc emits their bits instead.
+ * @param bits The bits of the double
+ * @return The double
+ */
+static inline double aotDouble(uint64_t bits) {
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+/**
+ * @brief Reports a runtime error from a compiled program. Kept out of line, so the many error paths of a program stay small.
+ * @param sp The stack top when the error happened
+ * @param line The line of the instruction that failed
+ * @param message The error message
+ * @return INTERPRET_RUNTIME_ERROR, for the compiled code to return
+ */
+InterpretResult aotError(Value* sp, int line, const char* message);
+
+/**
+ * @brief Reports the use of an undefined global variable from a compiled program, see aotError().
+ * @param sp The stack top when the error happened
+ * @param line The line of the instruction that failed
+ * @param slot The slot of the variable
+ * @return INTERPRET_RUNTIME_ERROR, for the compiled code to return
+ */
+InterpretResult aotUndefined(Value* sp, int line, int slot);
+
+/// @brief Reports a runtime error on the given line and leaves the compiled program.
+#define AOT_FAIL(line, message) return aotError(sp, line, message)
+
+/// @brief Fails unless the two Values on top of the stack are numbers.
+#define AOT_CHECK_NUMBERS(line)                          \
+    do {                                                 \
+        if (!IS_NUMBER(sp[-1]) || !IS_NUMBER(sp[-2]))    \
+            AOT_FAIL(line, "Operands must be numbers."); \
+    } while (false)
+
+#define AOT_CONSTANT(index) (*sp++ = k[index])
+#define AOT_NIL() (*sp++ = NIL_VAL)
+#define AOT_TRUE() (*sp++ = BOOL_VAL(true))
+#define AOT_FALSE() (*sp++ = BOOL_VAL(false))
+#define AOT_POP() (sp--)
+
+/// @brief OP_ADD: numbers are added, strings concatenated.
+#define AOT_ADD(line)                                                          \
+    do {                                                                       \
+        if (IS_NUMBER(sp[-1]) && IS_NUMBER(sp[-2])) {                          \
+            sp[-2] = NUMBER_VAL(AS_NUMBER(sp[-2]) + AS_NUMBER(sp[-1]));        \
+        } else if (IS_ANY_STRING(sp[-1]) && IS_ANY_STRING(sp[-2])) {           \
+            vm.stackTop = sp;                                                  \
+            gcSafePoint();                                                     \
+            sp[-2] = OBJ_VAL(concatenateLazy(AS_OBJ(sp[-2]), AS_OBJ(sp[-1]))); \
+        } else {                                                               \
+            AOT_FAIL(line, "Operands must be two numbers or two strings.");    \
+        }                                                                      \
+        sp--;                                                                  \
+    } while (false)
+
+/// @brief OP_SUBTRACT, OP_MULTIPLY and OP_DIVIDE (valueType NUMBER_VAL), OP_GREATER and OP_LESS (valueType BOOL_VAL).
+#define AOT_BINARY(valueType, op, line)                             \
+    do {                                                            \
+        AOT_CHECK_NUMBERS(line);                                    \
+        sp[-2] = valueType(AS_NUMBER(sp[-2]) op AS_NUMBER(sp[-1])); \
+        sp--;                                                       \
+    } while (false)
+
+/// @brief OP_GREATER_EQUAL and OP_LESS_EQUAL, "!(a op b)" so that NaN compares like in run().
+#define AOT_NOT_BINARY(op, line)                                      \
+    do {                                                              \
+        AOT_CHECK_NUMBERS(line);                                      \
+        sp[-2] = BOOL_VAL(!(AS_NUMBER(sp[-2]) op AS_NUMBER(sp[-1]))); \
+        sp--;                                                         \
+    } while (false)
+
+/// @brief The fused OP_*_CONSTANT instructions, whose constant is always a number.
+#define AOT_BINARY_CONSTANT(op, index, line, message)                  \
+    do {                                                               \
+        if (!IS_NUMBER(sp[-1]))                                        \
+            AOT_FAIL(line, message);                                   \
+        sp[-1] = NUMBER_VAL(AS_NUMBER(sp[-1]) op AS_NUMBER(k[index])); \
+    } while (false)
+
+/// @brief OP_EQUAL (negate false) and OP_NOT_EQUAL (negate true). Comparing ropes can flatten them, which allocates.
+#define AOT_EQUAL(negate)                                           \
+    do {                                                            \
+        vm.stackTop = sp;                                           \
+        gcSafePoint();                                              \
+        sp[-2] = BOOL_VAL(valuesEqual(sp[-2], sp[-1]) != (negate)); \
+        sp--;                                                       \
+    } while (false)
+
+#define AOT_NOT() (sp[-1] = BOOL_VAL(isFalsey(sp[-1])))
+
+#define AOT_NEGATE(line)                                 \
+    do {                                                 \
+        if (!IS_NUMBER(sp[-1]))                          \
+            AOT_FAIL(line, "Operand must be a number."); \
+        sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));         \
+    } while (false)
+
+#define AOT_PRINT()         \
+    do {                    \
+        vm.stackTop = sp;   \
+        gcSafePoint();      \
+        printValue(sp[-1]); \
+        printf("\n");       \
+        sp--;               \
+    } while (false)
+
+#define AOT_DEFINE_GLOBAL(slot)                           \
+    do {                                                  \
+        globalWriteBarrier(vm.globalValues.values[slot]); \
+        vm.globalValues.values[slot] = *--sp;             \
+    } while (false)
+
+/// @brief Fails if the global in the given slot was never defined.
+#define AOT_CHECK_DEFINED(slot, line)                   \
+    do {                                                \
+        if (IS_UNDEFINED(vm.globalValues.values[slot])) \
+            return aotUndefined(sp, line, slot);        \
+    } while (false)
+
+#define AOT_GET_GLOBAL(slot, line)            \
+    do {                                      \
+        AOT_CHECK_DEFINED(slot, line);        \
+        *sp++ = vm.globalValues.values[slot]; \
+    } while (false)
+
+#define AOT_SET_GLOBAL(slot, line)                        \
+    do {                                                  \
+        AOT_CHECK_DEFINED(slot, line);                    \
+        globalWriteBarrier(vm.globalValues.values[slot]); \
+        vm.globalValues.values[slot] = sp[-1];            \
+    } while (false)
+
+#define AOT_RETURN()         \
+    do {                     \
+        vm.stackTop = sp;    \
+        return INTERPRET_OK; \
+    } while (false)
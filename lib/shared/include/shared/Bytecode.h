@@ -0,0 +1,33 @@
+#pragma once
+
+#include <shared/Chunk.h>
+
+/// @brief Version of the .loxb format. Files of any other version are rejected, bump it on any change to the layout or to the opcodes.
+#define BYTECODE_VERSION 1
+
+/**
+ * @brief Writes a compiled Chunk to a .loxb file.
+ * @details The file holds the code, the line table, the Constant Pool, and the names of the globals the code refers to by slot (every global known to the VM, in slot order).
+ * Quickened instructions are written as their generic versions, so a Chunk that already ran saves the same as a fresh one.
+ * @param chunk The Chunk to write
+ * @param path The path of the file
+ * @return false if the file could not be written. The error has been reported.
+ */
+bool saveBytecode(Chunk* chunk, const char* path);
+
+/**
+ * @brief Loads a .loxb file written by saveBytecode() into a Chunk, ready to be run.
+ * @details The file is mapped privately, and the Chunk's code and line table point straight into the mapping, so loading copies nothing but the constants.
+ * Globals are looked up (or added) by name, and the code is only patched, copy-on-write, if their slots differ from those in the file.
+ * The file is checked for consistency (bounds, operands, stack depth) but is otherwise trusted to come from loxc.
+ * @param path The path of the file
+ * @param chunk An initialized, empty Chunk to load into. Free it with freeChunk(), which also unmaps the file.
+ * @return false if the file could not be read or is not valid. The error has been reported.
+ */
+bool loadBytecode(const char* path, Chunk* chunk);
+
+/**
+ * @brief Unmaps a file loaded by loadBytecode(). Called by freeChunk().
+ * @param mapping The mapping to release. May be NULL.
+ */
+void unmapBytecode(BytecodeMapping* mapping);
@@ -3,38 +3,119 @@
 #include <shared/common.h>
 #include <shared/Value.h>
 
+/**
+ * @brief X-macro listing every operation code of the bytecode, in enum order, along with the number of bytes of operands that follow it
+ * and its net effect on the depth of the stack.
+ * @details The OpCode enum and the dispatch table of the threaded interpreter are both generated from this list, so adding an opcode here is enough to keep them in sync.
+ * @param X The macro to apply to each operation code, as X(name, operandBytes, stackEffect)
+ */
+#define FOR_EACH_OPCODE(X)                                   \
+    X(OP_NOT, 0, 0)                                          \
+    X(OP_CONSTANT, 1, 1)                                     \
+    X(OP_CONSTANT_LONG, 3, 1)                                \
+    X(OP_ADD, 0, -1)                                         \
+    X(OP_SUBTRACT, 0, -1)                                    \
+    X(OP_NIL, 0, 1)                                          \
+    X(OP_TRUE, 0, 1)                                         \
+    X(OP_FALSE, 0, 1)                                        \
+    X(OP_EQUAL, 0, -1)                                       \
+    X(OP_GREATER, 0, -1)                                     \
+    X(OP_LESS, 0, -1)                                        \
+    X(OP_MULTIPLY, 0, -1)                                    \
+    X(OP_DIVIDE, 0, -1)                                      \
+    X(OP_NEGATE, 0, 0)                                       \
+    X(OP_PRINT, 0, -1)                                       \
+    X(OP_POP, 0, -1)                                         \
+    X(OP_DEFINE_GLOBAL, 2, -1)                               \
+    X(OP_GET_GLOBAL, 2, 1)                                   \
+    X(OP_SET_GLOBAL, 2, 0)                                   \
+    X(OP_RETURN, 0, 0)                                       \
+    /* Superinstructions, only emitted by optimizeChunk() */ \
+    X(OP_NOT_EQUAL, 0, -1)                                   \
+    X(OP_GREATER_EQUAL, 0, -1)                               \
+    X(OP_LESS_EQUAL, 0, -1)                                  \
+    X(OP_ADD_CONSTANT, 1, 0)                                 \
+    X(OP_SUBTRACT_CONSTANT, 1, 0)                            \
+    X(OP_MULTIPLY_CONSTANT, 1, 0)                            \
+    X(OP_DIVIDE_CONSTANT, 1, 0)                              \
+    /* Quickened instructions, only written by run() */      \
+    X(OP_ADD_NUM_NUM, 0, -1)                                 \
+    X(OP_SUBTRACT_NUM_NUM, 0, -1)                            \
+    X(OP_MULTIPLY_NUM_NUM, 0, -1)                            \
+    X(OP_DIVIDE_NUM_NUM, 0, -1)                              \
+    X(OP_GREATER_NUM, 0, -1)                                 \
+    X(OP_LESS_NUM, 0, -1)                                    \
+    X(OP_GREATER_EQUAL_NUM, 0, -1)                           \
+    X(OP_LESS_EQUAL_NUM, 0, -1)                              \
+    X(OP_NEGATE_NUM, 0, 0)
+
 /// @brief Operation codes for instructions in the bytecode
 typedef enum {
-    OP_NOT,
-    OP_CONSTANT,
-    OP_ADD,
-    OP_SUBTRACT,
-    OP_NIL,
-    OP_TRUE,
-    OP_FALSE,
-    OP_EQUAL,
-    OP_GREATER,
-    OP_LESS,
-    OP_MULTIPLY,
-    OP_DIVIDE,
-    OP_NEGATE,
-    OP_RETURN,
+#define OPCODE_ENUM(name, operandBytes, stackEffect) name,
+    FOR_EACH_OPCODE(OPCODE_ENUM)
+#undef OPCODE_ENUM
 } OpCode;
 
+/// @brief Number of constants that can be referenced with the 1 byte operand of OP_CONSTANT. Past this, OP_CONSTANT_LONG is used.
+#define CONSTANT_SHORT_MAX UINT8_MAX
+/// @brief Maximum number of constants in a chunk, as OP_CONSTANT_LONG uses a 3 byte operand.
+#define CONSTANTS_MAX (1 << 24)
+
+/**
+ * @brief Hash index over the constant pool, so a constant that is already in the pool can be reused instead of added again.
+ * @details Open addressing with linear probing. Constants are matched by identity: numbers by their bits (so 0 and -0 stay apart), and objects by pointer.
+ * @var ConstantIndex::capacity The number of slots, always 0 or a power of 2
+ * @var ConstantIndex::slots The index into the constant pool stored in each slot, or -1 if the slot is empty
+ */
+typedef struct {
+    int capacity;
+    int* slots;
+} ConstantIndex;
+
+/**
+ * @brief Start of a run of bytecode generated from the same source line.
+ * @var LineStart::offset The offset of the first byte of the run
+ * @var LineStart::line The line number of every byte in the run
+ */
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
+/// @brief Native code translated from a Chunk by the JIT. Only Jit.c knows its layout.
+typedef struct JitCode JitCode;
+
+/// @brief A .loxb file mapped by loadBytecode(). Only Bytecode.c knows its layout.
+typedef struct BytecodeMapping BytecodeMapping;
+
 /**
  * @brief A list of bytecode instructions
  * @var Chunk::count The current number of instructions in the list
  * @var Chunk::capacity The number of instructions the list can hold
  * @var Chunk::code The list of instructions
  * @var Chunk::constants The Constant Pool used by the instructions
- * @var Chunk::lines The line numbers of the instructions
+ * @var Chunk::constantIndex The index used to deduplicate the Constant Pool
+ * @var Chunk::maxStack The deepest the stack can get while running the chunk, as computed by maxStackDepth()
+ * @var Chunk::lineCount The number of runs in the line table
+ * @var Chunk::lineCapacity The number of runs the line table can hold
+ * @var Chunk::lines Run-length encoded line numbers of the instructions, ordered by offset. Use getLine() to look one up
+ * @var Chunk::invocations The number of times the VM started running the chunk. Decides when the JIT translates it
+ * @var Chunk::jit The native code translated from the chunk by compileJit(), NULL while it is interpreted
+ * @var Chunk::mapping The .loxb file code and lines point into when loaded by loadBytecode(), NULL when they were written by the compiler. capacity and lineCapacity are 0 then
  */
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
     ValueArray constants;
+    ConstantIndex constantIndex;
+    int maxStack;
+    int lineCount;
+    int lineCapacity;
+    LineStart* lines;
+    int invocations;
+    JitCode* jit;
+    BytecodeMapping* mapping;
 } Chunk;
 
 /**
@@ -58,9 +139,41 @@ void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 
 /**
- * @brief Add a constant to the constant pool
+ * @brief Gets the source line of the byte at the given offset, with a binary search over the line table
+ * @param chunk The chunk containing the byte
+ * @param offset The offset of the byte
+ * @return The line number the byte was compiled from
+ */
+int getLine(Chunk* chunk, int offset);
+
+/**
+ * @brief Add a constant to the constant pool, unless an identical one is already there
  * @param chunk The chunk to add the constant to
  * @param value The constant to add
  * @return The index of the constant in the constant pool
  */
 int addConstant(Chunk* chunk, Value value);
+
+/**
+ * @brief Drop every instruction from the given offset onwards, and every constant from the given index onwards.
+ * @details Used by the compiler to throw away code it managed to evaluate at compile time.
+ * @param chunk The chunk to truncate
+ * @param count The number of bytes of code to keep
+ * @param constantCount The number of constants to keep
+ */
+void truncateChunk(Chunk* chunk, int count, int constantCount);
+
+/**
+ * @brief Gets the size of the instruction at the given offset, including its operands
+ * @param chunk The chunk containing the instruction
+ * @param offset The offset of the instruction
+ * @return The number of bytes the instruction takes
+ */
+int instructionLength(Chunk* chunk, int offset);
+
+/**
+ * @brief Works out the maximum number of Values the chunk can have on the stack at once, from the stack effect of each of its instructions.
+ * @param chunk The chunk to analyze
+ * @return The maximum stack depth
+ */
+int maxStackDepth(Chunk* chunk);
@@ -45,6 +45,16 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
+/**
+ * @brief Where the bytecode of an operand starts, so it can be inspected (and folded away) once its operator is compiled.
+ * @var Operand::code The offset of the operand's first instruction in the chunk.
+ * @var Operand::constants The size of the constant pool before the operand was compiled.
+ */
+typedef struct {
+    int code;
+    int constants;
+} Operand;
+
 /**
  * @brief Scans, parses, and compiles the source code.
  * @param source The source code to compile.
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <shared/common.h>
+
+/// @brief Version of the heap image format. Images of any other version are rejected, bump it on any change to the layout.
+#define IMAGE_VERSION 2
+
+/// @brief A heap image mapped by loadImage(). Only Image.c knows its layout.
+typedef struct ImageMapping ImageMapping;
+
+/**
+ * @brief Writes the heap of the VM to an image file: every interned string, and every global variable with its value.
+ * @details Used to checkpoint the VM after running a prelude, so later processes can start from there with loadImage() instead of running it again.
+ * Ropes held by globals are flattened, and saved as the strings they stand for.
+ * @param path The path of the file
+ * @return false if the file could not be written. The error has been reported.
+ */
+bool saveImage(const char* path);
+
+/**
+ * @brief Loads an image written by saveImage() into a freshly initialized VM.
+ * @details The file is mapped privately and its strings are used in place, as objects of the VM, so loading copies no characters and hashes nothing:
+ * it only adds the strings to the intern table and defines the globals, in the slots they had when saved.
+ * The strings live as long as the mapping, which freeVM() releases.
+ * @param path The path of the file
+ * @return false if the file could not be read, is not valid, or the VM already has strings or globals. The error has been reported.
+ */
+bool loadImage(const char* path);
+
+/**
+ * @brief Unmaps an image loaded by loadImage(). Called by freeVM(), once nothing refers to its strings anymore.
+ * @param mapping The mapping to release. May be NULL.
+ */
+void unmapImage(ImageMapping* mapping);
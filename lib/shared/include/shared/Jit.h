@@ -0,0 +1,47 @@
+#pragma once
+
+#include <shared/Chunk.h>
+
+/// @brief Number of times a Chunk has to be run before JIT_ON translates it to native code.
+#define JIT_THRESHOLD 1000
+
+/**
+ * @brief When the VM translates Chunks to native code instead of interpreting them.
+ * @var JitMode::JIT_OFF Always interpret.
+ * @var JitMode::JIT_ON Translate a Chunk once it has been run JIT_THRESHOLD times.
+ * @var JitMode::JIT_ALWAYS Translate every Chunk before its first run.
+ */
+typedef enum {
+    JIT_OFF,
+    JIT_ON,
+    JIT_ALWAYS
+} JitMode;
+
+/**
+ * @brief Checks whether the JIT can produce code for the machine the VM runs on.
+ * @details Only x86-64 Linux is supported, and only when built with the LOX_JIT CMake option. Elsewhere, compileJit() always fails and the interpreter runs everything.
+ * @return Whether compileJit() can succeed.
+ */
+bool jitSupported();
+
+/**
+ * @brief Translates a Chunk into native code, in its own executable mapping.
+ * @details The code keeps pointers into the Chunk's code and Constant Pool, so it is only valid as long as the Chunk is, and is freed along with it.
+ * @param chunk The Chunk to translate. Quickened instructions are translated like their generic versions.
+ * @return The native code, or NULL if the JIT is not supported or the Chunk has an instruction it cannot translate.
+ */
+JitCode* compileJit(Chunk* chunk);
+
+/**
+ * @brief Runs native code produced by compileJit(), from the start of its Chunk, with the stack starting at VM::stackTop.
+ * @details Like the interpreter, the code relies on the stack having room for Chunk::maxStack more Values.
+ * @param code The native code to run.
+ * @return false if a runtime error occurred. It has already been reported.
+ */
+bool runJit(JitCode* code);
+
+/**
+ * @brief Frees native code produced by compileJit().
+ * @param code The native code to free. May be NULL.
+ */
+void freeJit(JitCode* code);
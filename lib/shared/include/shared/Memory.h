@@ -1,6 +1,182 @@
 #pragma once
 
 #include <shared/common.h>
+#include <shared/Object.h>
+#include <shared/Table.h>
+
+#ifndef NURSERY_SIZE
+    /// @brief Size in bytes of the young generation, where new objects are bump allocated.
+    #define NURSERY_SIZE (1 << 20)
+#endif
+
+/// @brief Objects bigger than this are allocated straight in the old generation: copying them would cost more than it saves.
+#define NURSERY_MAX_OBJECT (NURSERY_SIZE / 16)
+
+#ifndef GC_FIRST_MAJOR
+    /// @brief Size of the old generation, in bytes, that triggers the first major collection.
+    #define GC_FIRST_MAJOR (4 << 20)
+#endif
+
+/// @brief After a major collection, the next one happens once the old generation has grown by this factor.
+#define GC_HEAP_GROW_FACTOR 2
+
+/// @brief Default pause-time target of major collection slices, in microseconds. 0 runs each major collection in one go.
+#define GC_DEFAULT_PAUSE_US 500
+
+#ifndef GC_SLICE_QUANTUM
+    /// @brief While a major collection is in progress, a slice of it runs every time this many bytes have been allocated.
+    #define GC_SLICE_QUANTUM (256 * 1024)
+#endif
+
+#ifndef GC_WORK_CHUNK
+    /// @brief Number of objects marked or swept between two looks at the clock.
+    #define GC_WORK_CHUNK 256
+#endif
+
+/// @brief Blocks of reallocate() up to this size come from its size-class pools, bigger ones from malloc().
+#define POOL_MAX_SIZE 256
+
+/// @brief The sizes of the pools' classes are multiples of this, which is also the alignment of their blocks.
+#define POOL_GRANULE 16
+
+/// @brief Size of the slabs the pools carve their blocks from, allocated with malloc().
+#define POOL_SLAB_SIZE (64 * 1024)
+
+/// @brief Number of buckets of the pause histogram. Bucket 0 counts pauses under 1us, bucket b those from 2^(b-1) to 2^b us, the last one everything longer.
+#define GC_PAUSE_BUCKETS 24
+
+/**
+ * @brief Statistics of the garbage collector, reported by lox --gc-stats.
+ * @var GcStats::minorCollections The number of minor collections
+ * @var GcStats::majorCollections The number of major collections completed
+ * @var GcStats::majorSlices The number of slices major collections were carried out in
+ * @var GcStats::nurseryBytes The bytes bump allocated in the nursery and collected so far
+ * @var GcStats::promotedBytes The bytes of the nursery that survived a minor collection, and were promoted to the old generation
+ * @var GcStats::minorNanoseconds The total pause time of minor collections
+ * @var GcStats::minorMaxNanoseconds The longest minor collection
+ * @var GcStats::majorNanoseconds The total time spent in major collection slices
+ * @var GcStats::majorMaxNanoseconds The longest major collection slice
+ * @var GcStats::pauses The number of times the program was paused to collect, a minor collection and a major slice being one pause when they run together
+ * @var GcStats::maxPauseNanoseconds The longest pause
+ * @var GcStats::pauseHistogram The number of pauses by duration, see GC_PAUSE_BUCKETS
+ */
+typedef struct {
+    uint64_t minorCollections;
+    uint64_t majorCollections;
+    uint64_t majorSlices;
+    uint64_t nurseryBytes;
+    uint64_t promotedBytes;
+    uint64_t minorNanoseconds;
+    uint64_t minorMaxNanoseconds;
+    uint64_t majorNanoseconds;
+    uint64_t majorMaxNanoseconds;
+    uint64_t pauses;
+    uint64_t maxPauseNanoseconds;
+    uint64_t pauseHistogram[GC_PAUSE_BUCKETS];
+} GcStats;
+
+/**
+ * @brief Phase of the major collection.
+ * @var GcPhase::GC_IDLE No major collection in progress
+ * @var GcPhase::GC_MARKING Tracing the old generation from the gray objects, on the marker thread if there is one. Old objects allocated or promoted
+ * meanwhile are born marked
+ * @var GcPhase::GC_PURGING Removing the unmarked strings from the intern table. Old objects are still born marked, and strings interned again are marked
+ * @var GcPhase::GC_SWEEPING Freeing the unmarked objects of Heap::sweeping
+ */
+typedef enum {
+    GC_IDLE,
+    GC_MARKING,
+    GC_PURGING,
+    GC_SWEEPING
+} GcPhase;
+
+/**
+ * @brief A stack of gray objects: marked, but with references still to be marked.
+ * @var GrayStack::objects The objects
+ * @var GrayStack::count The number of objects
+ * @var GrayStack::capacity The number of objects the stack can hold
+ */
+typedef struct {
+    Obj** objects;
+    int count;
+    int capacity;
+} GrayStack;
+
+/**
+ * @brief State of the generational garbage collector.
+ * @details New objects are bump allocated in the nursery. A minor collection copies the ones still reachable into the old generation, which is a list of
+ * individually allocated objects (VM::objects), and empties the nursery. A major collection marks the old generation, purges the intern table and sweeps,
+ * one slice of at most Heap::pauseNanoseconds every GC_SLICE_QUANTUM bytes allocated. With Heap::concurrent, a marker thread does the marking between
+ * slices, which then only hand it the objects the program shaded and check whether it is done.
+ * Collections only happen at safe points, see gcSafePoint(), where every live object is reachable from the roots. The roots are the stack, the globals and
+ * the Constant Pool of the running Chunk. Objects allocated when the nursery is full go to the old generation directly, until the next safe point.
+ *
+ * Marking traces a snapshot of the heap, taken when it starts: a minor collection empties the nursery, then every root is shaded in the same pause.
+ * The roots are not scanned again. Whatever the program stores from then on is either new, and born marked, or was reachable in the snapshot, and will be
+ * marked as long as no reference from the snapshot is lost before the collector sees it. The only references overwritten are globals, whose old Value
+ * globalWriteBarrier() shades. The stack only loses Values by popping them, and they were shaded with the stack. Fields of objects are written once, from
+ * NULL, except the halves of a rope, dropped once it is flattened, after which nothing reads them. Strings found again in the intern table, which does not keep them alive, are shaded too. The Compiler does not reach safe points, and its
+ * constants are strings, new or found in the intern table, so they need nothing more.
+ * @var Heap::nursery The start of the nursery. NULL until the first object is allocated
+ * @var Heap::nurseryTop Where the next object goes in the nursery
+ * @var Heap::nurseryLimit Past this, the next safe point runs a minor collection
+ * @var Heap::nurseryEnd The end of the nursery
+ * @var Heap::oldBytes The bytes taken by the objects of the old generation
+ * @var Heap::nextMajor The size of the old generation that triggers the next major collection
+ * @var Heap::collectionPending Whether the next safe point has to collect
+ * @var Heap::concurrent Whether marking happens on a background thread. Defaults to whether the build supports it and the machine has several cores
+ * @var Heap::stress Whether every safe point runs a minor collection and one step of a major one, started if need be, to shake out barrier bugs
+ * @var Heap::phase The phase of the major collection
+ * @var Heap::pauseNanoseconds The longest a major collection slice should take. 0 runs major collections in one go
+ * @var Heap::allocatedSinceSlice The bytes allocated since the last slice of the major collection
+ * @var Heap::purgeIndex The next slot of the intern table to purge
+ * @var Heap::purgeEntries The entries of the intern table being purged. The purge starts over if the table reallocates them
+ * @var Heap::sweeping The objects left to sweep. The old generation is moved here when the purge ends, and survivors are moved back
+ * @var Heap::remembered The old objects that may refer to objects in the nursery, recorded by writeBarrier(). Roots of minor collections
+ * @var Heap::rememberedCount The number of remembered objects
+ * @var Heap::rememberedCapacity The number of objects the remembered set can hold
+ * @var Heap::gray The gray objects left to trace. Shared with the marker thread, under its lock
+ * @var Heap::shaded The objects the program shaded since the last slice, handed to Heap::gray by the next one
+ * @var Heap::stats Statistics for --gc-stats
+ */
+typedef struct {
+    uint8_t* nursery;
+    uint8_t* nurseryTop;
+    uint8_t* nurseryLimit;
+    uint8_t* nurseryEnd;
+    size_t oldBytes;
+    size_t nextMajor;
+    bool collectionPending;
+    bool concurrent;
+    bool stress;
+    GcPhase phase;
+    uint64_t pauseNanoseconds;
+    size_t allocatedSinceSlice;
+    int purgeIndex;
+    Entry* purgeEntries;
+    Obj* sweeping;
+    Obj** remembered;
+    int rememberedCount;
+    int rememberedCapacity;
+    GrayStack gray;
+    GrayStack shaded;
+    GcStats stats;
+} Heap;
+
+/**
+ * @brief Macro to allocate an array of the given type. Makes a call to reallocate().
+ * @param type The type of the elements to allocate.
+ * @param count The number of elements to allocate.
+ */
+#define ALLOCATE(type, count) \
+    (type*)reallocate(NULL, 0, sizeof(type) * (count))
+
+/**
+ * @brief Macro to free a single value of the given type. Makes a call to reallocate().
+ * @param type The type of the value to free.
+ * @param pointer The pointer to the value to free.
+ */
+#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
 /**
  * @brief Macro calculates a new capacity based on a given current capacity. Grows by a factor of 2.
@@ -33,8 +209,83 @@
  * @details If the old size is 0, the block is allocated.
  * @details If the new size is less than the old size, shrink existing allcation.
  * @details If the new size is greater than the old size, grow existing allocation.
+ * @details With POOL_ALLOCATOR, blocks of up to POOL_MAX_SIZE bytes come from segregated free lists, one per size class, and never reach malloc():
+ * the size of a block is not stored anywhere, so the old size must be the exact size the block was allocated with.
  * @param pointer The pointer to the block to reallocate.
  * @param oldSize The old size of the block to reallocate.
  * @param newSize The new size of the block to reallocate.
  */
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+
+/**
+ * @brief Gives the slabs of the size-class pools back to the system, if none of their blocks is in use anymore. Called by freeVM().
+ */
+void releasePools();
+
+/**
+ * @brief Initializes the garbage collector's state. The nursery is only allocated along with the first object.
+ * @param heap The state to initialize
+ */
+void initHeap(Heap* heap);
+
+/**
+ * @brief Allocates memory for a new object: bump allocated in the nursery, or in the old generation if it is big or the nursery is full.
+ * @details Never collects, so objects held in C variables stay valid. It only flags a collection for the next safe point.
+ * @param size The size of the object
+ * @return The memory for the object, with Obj::next and Obj::isMarked cleared. Objects of the old generation are linked into VM::objects by initObject().
+ */
+Obj* allocateObject(size_t size);
+
+/**
+ * @brief Gives back the memory of an object that was never made reachable. In the nursery, this only works for the last object allocated.
+ * @param object The object
+ * @param size The size of the object
+ */
+void discardObject(Obj* object, size_t size);
+
+/**
+ * @brief Checks whether an object is in the nursery.
+ * @param object The object
+ * @return Whether the object is young
+ */
+bool isYoung(Obj* object);
+
+/**
+ * @brief Records that an old object now refers to another object, so that minor collections know to look at it. Stores into objects have to call it.
+ * @details Fields are only ever written once, from NULL, or cleared, so major collections need nothing from it, see Heap.
+ * @param object The object written to
+ * @param value The object it now refers to. May be NULL.
+ */
+void writeBarrier(Obj* object, Obj* value);
+
+/**
+ * @brief Keeps a major collection in progress from losing an object it has not traced yet, such as the old Value of a global that is overwritten.
+ * @details Called through globalWriteBarrier(), which skips the call when no collection is marking.
+ * @param value The Value about to be lost
+ */
+void shadeValue(Value value);
+
+/**
+ * @brief Checks whether the build can mark on a background thread.
+ * @return Whether Heap::concurrent has any effect
+ */
+bool concurrentMarkingSupported();
+
+/**
+ * @brief Estimates a percentile of the pause times from GcStats::pauseHistogram.
+ * @param stats The statistics
+ * @param percentile The percentile, from 0 to 100
+ * @return The upper bound of the histogram bucket the percentile falls in, in microseconds. For the last bucket, the longest pause.
+ */
+uint64_t pausePercentile(const GcStats* stats, double percentile);
+
+/**
+ * @brief Runs a minor collection if the nursery is full, then starts or continues the major collection, if any, for one slice.
+ * @details Only called from safe points, see gcSafePoint(). The whole call is one pause, recorded in GcStats.
+ */
+void collectGarbage();
+
+/**
+ * @brief Frees every object allocated by the VM, and the nursery.
+ */
+void freeObjects();
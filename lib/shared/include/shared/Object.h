@@ -17,6 +17,20 @@
  */
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 
+/**
+ * @brief Checks if a Value is of type ObjRope.
+ * @param value The Value to check the object type of
+ * @return Whether the Value is of the type ObjRope
+ */
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
+
+/**
+ * @brief Checks if a Value is a Lox string, flat (ObjString) or not (ObjRope).
+ * @param value The Value to check
+ * @return Whether the Value is a string
+ */
+#define IS_ANY_STRING(value) (IS_STRING(value) || IS_ROPE(value))
+
 /**
  * @brief "Cast" a Value to an ObjString.
  * @param value The Value be casted to an ObjString
@@ -31,30 +45,120 @@
  */
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
 
-/**
- * @brief Checks if a Value is of a specific object type.
- * @param value The Value to check the object type of
- * @param type The object type to check for
- * @return Whether the Value is of the specified object type
- */
-static inline bool isObjType(Value value, ObjType type) {
-    // This was made into a function because if on the macro, value would be evaluated twice
-    return IS_OBJ(value) && AS_OBJ(value)->type == type;
-}
-
 /// @brief The type of an object.
 typedef enum {
     OBJ_STRING,
+    OBJ_ROPE,
 } ObjType;
 
-/// @brief Representation of an object from Lox.
+/**
+ * @brief Representation of an object from Lox.
+ * @var Obj::type The type of the object
+ * @var Obj::isMarked Whether a major collection found the object reachable. Always set for the objects of a heap image, which are never freed
+ * @var Obj::next The next object in the old generation, VM::objects. In the nursery, NULL until a minor collection copies the object, then the copy
+ */
 struct Obj {
     ObjType type;
+    bool isMarked;
+    struct Obj* next;
 };
 
-/// @brief Representation of a string object from Lox.
+/**
+ * @brief Representation of a string object from Lox. Strings are immutable and interned, so two equal strings are always the same object.
+ * @details The characters are stored right after the header, in the same allocation, so a string costs a single malloc and reading them needs no extra pointer chase.
+ * @var ObjString::obj The object header
+ * @var ObjString::length The number of characters, without the null terminator
+ * @var ObjString::hash The FNV-1a hash of the characters, computed once when the string is created
+ * @var ObjString::chars The null-terminated characters
+ */
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
+    uint32_t hash;
+    char chars[];
+};
+
+/**
+ * @brief Minimum length for a concatenation to be left lazy, as an ObjRope. Shorter ones are copied right away, like any other string.
+ */
+#define ROPE_MIN_LENGTH 64
+
+/**
+ * @brief A concatenation of two strings that has not been carried out yet. It is the same Lox string as its flattened ObjString.
+ * @details Building a long string one piece at a time (s = s + x) would otherwise copy everything built so far on each step. A rope only links its two halves,
+ * and the characters are copied once, by flattenRope(), when they are actually needed (printing, equality, hashing).
+ * @var ObjRope::obj The object header
+ * @var ObjRope::length The number of characters of the whole string
+ * @var ObjRope::left The left half, an ObjString or ObjRope. NULL once flattened
+ * @var ObjRope::right The right half, an ObjString or ObjRope. NULL once flattened
+ * @var ObjRope::flat The flattened, interned string. NULL until the rope is flattened
+ */
+struct ObjRope {
+    Obj obj;
+    int length;
+    Obj* left;
+    Obj* right;
+    ObjString* flat;
 };
+
+/**
+ * @brief Size of the allocation of a string with the given number of characters.
+ * @param length The number of characters, without the null terminator
+ */
+#define STRING_SIZE(length) (sizeof(ObjString) + (size_t)(length) + 1)
+
+/**
+ * @brief Checks if a Value is of a specific object type.
+ * @param value The Value to check the object type of
+ * @param type The object type to check for
+ * @return Whether the Value is of the specified object type
+ */
+static inline bool isObjType(Value value, ObjType type) {
+    // This was made into a function because if on the macro, value would be evaluated twice
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+/**
+ * @brief Creates a string object by copying the given characters. If an equal string already exists, that one is returned instead.
+ * @param chars The characters to copy
+ * @param length The number of characters
+ * @return The interned string
+ */
+ObjString* copyString(const char* chars, int length);
+
+/**
+ * @brief Concatenates two strings into a new one, interned like every other string.
+ * @param a The left string
+ * @param b The right string
+ * @return The interned concatenation
+ */
+ObjString* concatenateStrings(ObjString* a, ObjString* b);
+
+/**
+ * @brief Concatenates two strings, flat or ropes. Short results are flattened and interned right away, long ones are left as an ObjRope.
+ * @param a The left string
+ * @param b The right string
+ * @return The concatenation, an ObjString or ObjRope
+ */
+Obj* concatenateLazy(Obj* a, Obj* b);
+
+/**
+ * @brief Gets the characters of a rope, copying them into an interned string the first time.
+ * @param rope The rope to flatten
+ * @return The interned string with the rope's characters
+ */
+ObjString* flattenRope(ObjRope* rope);
+
+/**
+ * @brief Checks if two Values are strings (flat or ropes) with the same characters. Ropes are flattened to do so.
+ * @param a The first Value
+ * @param b The second Value
+ * @return Whether the Values are equal strings
+ */
+bool stringsEqual(Value a, Value b);
+
+/**
+ * @brief Prints an object Value to the console.
+ * @param value The Value to print
+ */
+void printObject(Value value);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <shared/Chunk.h>
+
+/**
+ * @brief Peephole pass over a compiled chunk, rewriting common instruction sequences into a single superinstruction.
+ * @details Fuses OP_EQUAL, OP_LESS and OP_GREATER followed by OP_NOT into OP_NOT_EQUAL, OP_GREATER_EQUAL and OP_LESS_EQUAL,
+ * and a number OP_CONSTANT followed by an arithmetic instruction into its *_CONSTANT form. Each fused instruction keeps the line of the
+ * instruction that could fail at runtime, so errors are still reported on the same line.
+ * @param chunk The chunk to optimize, after the compiler is done with it.
+ */
+void optimizeChunk(Chunk* chunk);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <shared/common.h>
+#include <shared/Value.h>
+
+/// @brief Number of slots probed at once. A group's control bytes fit in one SSE2 register.
+#define TABLE_GROUP_WIDTH 16
+
+/**
+ * @brief An entry of a hash table.
+ * @var Entry::key The key of the entry. NULL for slots not in use
+ * @var Entry::value The value of the entry
+ */
+typedef struct {
+    ObjString* key;
+    Value value;
+} Entry;
+
+/**
+ * @brief Hash table with string keys, in the style of a Swiss table.
+ * @details Open addressing over groups of TABLE_GROUP_WIDTH slots. Each slot has a control byte, either empty, deleted, or the low 7 bits of its key's hash when in use.
+ * A lookup compares the hash bits against a whole group of control bytes at once, and only looks at the entries that match. It stops at the first group with an empty slot.
+ * @var Table::count The number of entries in use
+ * @var Table::tombstones The number of deleted slots that still have to be treated as in use by probe sequences
+ * @var Table::capacity The number of slots allocated, 0 or a multiple of TABLE_GROUP_WIDTH
+ * @var Table::control The control byte of each slot
+ * @var Table::entries The entries of the table
+ */
+typedef struct {
+    int count;
+    int tombstones;
+    int capacity;
+    uint8_t* control;
+    Entry* entries;
+} Table;
+
+/**
+ * @brief Initialize a hash table, with a capacity of 0.
+ * @param table The table to initialize
+ */
+void initTable(Table* table);
+
+/**
+ * @brief Free the memory used by a hash table.
+ * @param table The table to free
+ */
+void freeTable(Table* table);
+
+/**
+ * @brief Looks up the value stored under a key.
+ * @param table The table to look in
+ * @param key The key to look for
+ * @param value Where to store the value, if the key is found
+ * @return Whether the key was found
+ */
+bool tableGet(Table* table, ObjString* key, Value* value);
+
+/**
+ * @brief Stores a value under a key, replacing the previous value if there was one.
+ * @param table The table to store in
+ * @param key The key to store under
+ * @param value The value to store
+ * @return Whether the key is new to the table
+ */
+bool tableSet(Table* table, ObjString* key, Value value);
+
+/**
+ * @brief Removes a key from the table. Only leaves a tombstone behind if a probe sequence could go through its slot.
+ * @param table The table to remove from
+ * @param key The key to remove
+ * @return Whether the key was in the table
+ */
+bool tableDelete(Table* table, ObjString* key);
+
+/**
+ * @brief Looks up a key by its characters instead of by identity. Used for interning strings.
+ * @param table The table to look in
+ * @param chars The characters of the string
+ * @param length The length of the string
+ * @param hash The hash of the string
+ * @return The key with the same characters, or NULL if there is none
+ */
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
@@ -1,25 +1,74 @@
 #pragma once
 
 #include <shared/Chunk.h>
+#include <shared/Image.h>
+#include <shared/Jit.h>
+#include <shared/Memory.h>
+#include <shared/Table.h>
 #include <shared/Value.h>
 
-/// @brief Maximum number of values that can be stored on the stack.
-#define STACK_MAX 256
+#ifndef STACK_MAX
+    /// @brief Maximum number of values that can be stored on the stack. Can be changed with the LOX_STACK_MAX CMake option.
+    #define STACK_MAX (1 << 20)
+#endif
+
+/// @brief Maximum number of global variables. Global instructions use 2 bytes for the slot operand.
+#define GLOBALS_MAX (UINT16_MAX + 1)
 
 /**
  * @brief Virtual Machine struct.
  * @var VM::chunk The Chunk to execute.
  * @var VM::ip The current instruction pointer.
- * @var VM::stack The stack of Values.
+ * @var VM::stack The stack of Values. Allocated on first use and grown on demand, up to STACK_MAX Values.
  * @var VM::stackTop The top of the stack.
+ * @var VM::stackEnd The end of the memory allocated for the stack.
+ * @var VM::strings The intern table. Every string in the VM is a key in it, so equal strings are the same object.
+ * @var VM::internLookups The number of times a string was looked up in the intern table before being created.
+ * @var VM::internHits The number of lookups that found an existing string, so no new one was created.
+ * @var VM::objects The old generation: every object allocated outside of the nursery or promoted from it, linked through Obj::next.
+ * @var VM::globalSlots Maps the name of each global variable to its slot, as a number Value. Only used by the compiler, the bytecode refers to globals by slot.
+ * @var VM::globalValues The value of each global variable, indexed by slot. UNDEFINED_VAL until the variable is defined.
+ * @var VM::globalNames The name of each global variable, indexed by slot. Only used for error messages.
+ * @var VM::jitMode When chunks are translated to native code. JIT_OFF unless changed after initVM().
+ * @var VM::heap The state of the garbage collector.
+ * @var VM::image The heap image loaded by loadImage(), whose strings are interned but not on VM::objects. NULL if none was loaded.
  */
 typedef struct {
     Chunk* chunk;
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    Value* stack;
     Value* stackTop;
+    Value* stackEnd;
+    Table strings;
+    uint64_t internLookups;
+    uint64_t internHits;
+    Obj* objects;
+    Table globalSlots;
+    ValueArray globalValues;
+    ValueArray globalNames;
+    JitMode jitMode;
+    Heap heap;
+    ImageMapping* image;
 } VM;
 
+/**
+ * @brief Statistics of the intern table, for tuning.
+ * @var InternStats::count The number of strings interned.
+ * @var InternStats::capacity The number of entries allocated in the table.
+ * @var InternStats::tableBytes The memory used by the table's entries.
+ * @var InternStats::stringBytes The memory used by the interned strings themselves, headers and characters.
+ * @var InternStats::lookups The number of lookups made when creating strings.
+ * @var InternStats::hits The number of lookups that found an existing string.
+ */
+typedef struct {
+    int count;
+    int capacity;
+    size_t tableBytes;
+    size_t stringBytes;
+    uint64_t lookups;
+    uint64_t hits;
+} InternStats;
+
 /**
  * @brief Result of interpreting a Chunk.
  * @var InterpretResult::INTERPRET_OK The Chunk was interpreted successfully.
@@ -32,6 +81,30 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
+/// @brief The Virtual Machine.
+extern VM vm;
+
+/**
+ * @brief Runs the garbage collector if an allocation asked for it. Called before anything that can allocate at run time.
+ * @details Collections move objects, so they only happen here, where every live object is on the stack, in a global or in the Constant Pool:
+ * callers must not hold objects in C variables across the call.
+ */
+static inline void gcSafePoint() {
+    if (vm.heap.collectionPending) {
+        collectGarbage();
+    }
+}
+
+/**
+ * @brief Write barrier of the global variables, called with the old Value of a global before it is overwritten, see shadeValue().
+ * @param value The Value about to be overwritten
+ */
+static inline void globalWriteBarrier(Value value) {
+    if (vm.heap.phase == GC_MARKING) {
+        shadeValue(value);
+    }
+}
+
 /**
  * @brief Initializes the Virtual Machine.
  */
@@ -50,7 +123,45 @@ void freeVM();
 InterpretResult interpret(const char* source);
 
 /**
- * @brief Pushes a Value onto the stack.
+ * @brief Runs an already compiled Chunk, such as one loaded by loadBytecode().
+ * @param chunk The Chunk to run. It is not freed.
+ * @return The result of running the Chunk.
+ */
+InterpretResult interpretChunk(Chunk* chunk);
+
+/**
+ * @brief Gets the slot of a global variable, giving it a new undefined one if the name was never seen before.
+ * @details Slots outlive the chunk that created them, so every chunk run by the VM (each line of the REPL, for instance) sees the same globals.
+ * @param name The name of the global variable
+ * @return The slot of the global variable in VM::globalValues
+ */
+int globalSlot(ObjString* name);
+
+/**
+ * @brief Reports a runtime error, with the line of the instruction just before VM::ip, and resets the stack.
+ * @param format The error message, a printf format
+ * @param ... The arguments to the error message
+ */
+void runtimeError(const char* format, ...);
+
+/**
+ * @brief Reports a runtime error on a given line, and resets the stack. For code that does not run from VM::chunk, like programs compiled by loxc.
+ * @param line The line to report
+ * @param format The error message, a printf format
+ * @param ... The arguments to the error message
+ */
+void runtimeErrorAt(int line, const char* format, ...);
+
+/**
+ * @brief Makes sure the stack has room for a given number of extra Values, growing it if needed.
+ * @details Growing moves the stack, so any pointer into it other than VM::stackTop is invalidated.
+ * @param count The number of Values that will be pushed.
+ * @return false if the stack would have to grow past STACK_MAX.
+ */
+bool reserveStack(int count);
+
+/**
+ * @brief Pushes a Value onto the stack. Does not check for room, that has to be done beforehand with reserveStack().
  * @param value The Value to push.
  */
 void push(Value value);
@@ -60,3 +171,9 @@ void push(Value value);
  * @return The Value that was popped.
  */
 Value pop();
+
+/**
+ * @brief Gathers the statistics of the intern table.
+ * @return The current statistics.
+ */
+InternStats internStats();
@@ -8,12 +8,141 @@ typedef struct Obj Obj;
 /// @brief Representation of a string object from Lox.
 typedef struct ObjString ObjString;
 
+/// @brief Representation of a string from Lox that is a concatenation not carried out yet.
+typedef struct ObjRope ObjRope;
+
+#ifdef NAN_BOXING
+
+/**
+ * @brief Sign bit of a double. Set, together with the quiet NaN bits, on every object Value.
+ * @details A Value is a double reinterpreted as 64 bits. Numbers are stored as is, while every other type lives in the unused payload of a quiet NaN:
+ * the quiet NaN bits (plus Intel's "QNaN Floating-Point Indefinite" bit) tag the Value as a non-number, the low bits hold a tag for singletons,
+ * and objects additionally set the sign bit and keep their pointer (at most 48 bits on x86-64 and AArch64) in the payload.
+ */
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+/// @brief Bits set on every Value that is not a number.
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+/// @brief Payload tag of nil.
+#define TAG_NIL 1
+/// @brief Payload tag of false.
+#define TAG_FALSE 2
+/// @brief Payload tag of true.
+#define TAG_TRUE 3
+/// @brief Payload tag of the undefined marker.
+#define TAG_UNDEFINED 4
+
+/// @brief Representation of a value from Lox, NaN-boxed into 8 bytes.
+typedef uint64_t Value;
+
+/**
+ * @brief Reinterpret the bits of a Value as a double.
+ * @param value The Value to reinterpret
+ * @return The number stored in the Value
+ */
+static inline double valueToNum(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+/**
+ * @brief Reinterpret the bits of a double as a Value.
+ * @param num The number to reinterpret
+ * @return The Value holding the number
+ */
+static inline Value numToValue(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+/**
+ * @brief Get the object value of a Value.
+ * @param value The Value to get the object value of
+ * @return The object value of the Value
+ */
+#define AS_OBJ(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+/**
+ * @brief Get the boolean value of a Value.
+ * @param value The Value to get the boolean value of
+ * @return The boolean value of the Value
+ */
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+/**
+ * @brief Get the number value of a Value.
+ * @param value The Value to get the number value of
+ * @return The number value of the Value
+ */
+#define AS_NUMBER(value) valueToNum(value)
+
+/**
+ * @brief Create a Value with a boolean value.
+ * @param value The boolean value to create the Value with
+ * @return The created Value
+ */
+#define BOOL_VAL(value) ((value) ? TRUE_VAL : FALSE_VAL)
+/// @brief The false Value.
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+/// @brief The true Value.
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+/// @brief The nil Value.
+#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+/// @brief Marks a global variable slot whose name was seen but that was never defined. Never visible to Lox code.
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+/**
+ * @brief Create a Value with a number value.
+ * @param value The number value to create the Value with
+ * @return The created Value
+ */
+#define NUMBER_VAL(value) numToValue(value)
+/**
+ * @brief Create a Value with an object value.
+ * @param value The object value to create the Value with
+ * @return The created Value
+ */
+#define OBJ_VAL(value) ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(value)))
+
+/**
+ * @brief Check if a Value is a boolean. true and false only differ in the lowest bit.
+ * @param value The Value to check
+ * @return Whether the Value is a boolean
+ */
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+/**
+ * @brief Check if a Value is nil.
+ * @param value The Value to check
+ * @return Whether the Value is nil
+ */
+#define IS_NIL(value) ((value) == NIL_VAL)
+/**
+ * @brief Check if a Value is the undefined marker.
+ * @param value The Value to check
+ * @return Whether the Value is the undefined marker
+ */
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+/**
+ * @brief Check if a Value is a number. Every Value that does not have all the quiet NaN bits set is a number.
+ * @param value The Value to check
+ * @return Whether the Value is a number
+ */
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+/**
+ * @brief Check if a Value is an object.
+ * @param value The Value to check
+ * @return Whether the Value is an object
+ */
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#else
+
 /// @brief The type of a Value.
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
     VAL_OBJ,
+    VAL_UNDEFINED,
 } ValueType;
 
 /// @brief Representation of a value from Lox.
@@ -56,6 +185,8 @@ typedef struct {
  * @return The created Value
  */
 #define NIL_VAL ((Value){ VAL_NIL, { .number = 0 } })
+/// @brief Marks a global variable slot whose name was seen but that was never defined. Never visible to Lox code.
+#define UNDEFINED_VAL ((Value){ VAL_UNDEFINED, { .number = 0 } })
 /**
  * @brief Create a Value with a number value.
  * @param value The number value to create the Value with
@@ -81,6 +212,12 @@ typedef struct {
  * @return Whether the Value is nil
  */
 #define IS_NIL(value) ((value).type == VAL_NIL)
+/**
+ * @brief Check if a Value is the undefined marker.
+ * @param value The Value to check
+ * @return Whether the Value is the undefined marker
+ */
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 /**
  * @brief Check if a Value is a number.
  * @param value The Value to check
@@ -94,6 +231,8 @@ typedef struct {
  */
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
+#endif
+
 /**
  * @brief A list for literal values. Used for the constant pool.
  * @var ValueArray::count The number of values currently stored in the list.
@@ -114,6 +253,15 @@ typedef struct {
  */
 bool valuesEqual(Value a, Value b);
 
+/**
+ * @brief Checks if a Value is falsey. A Value is falsey if it is nil or false.
+ * @param value The Value to check
+ * @return Whether the Value is falsey
+ */
+static inline bool isFalsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
 /**
  * @brief Initialize a ValueArray, with a capacity of 0.
  * @param array The ValueArray to initialize
@@ -0,0 +1,37 @@
+#include <sysexits.h>
+#include <shared/Aot.h>
+
+int runAot(AotLoader load, AotScript script) {
+    initVM();
+
+    // The chunk has no code, but setting it as VM::chunk makes its constants reachable like those of an interpreted chunk.
+    Chunk chunk;
+    initChunk(&chunk);
+    vm.chunk = &chunk;
+    vm.ip = NULL;
+    load(&chunk);
+
+    InterpretResult result;
+    if (!reserveStack(chunk.maxStack)) {
+        runtimeErrorAt(1, "Stack overflow.");
+        result = INTERPRET_RUNTIME_ERROR;
+    } else {
+        result = script(vm.stackTop, chunk.constants.values);
+    }
+
+    freeChunk(&chunk);
+    freeVM();
+    return result == INTERPRET_OK ? 0 : EX_SOFTWARE;
+}
+
+InterpretResult aotError(Value* sp, int line, const char* message) {
+    vm.stackTop = sp;
+    runtimeErrorAt(line, "%s", message);
+    return INTERPRET_RUNTIME_ERROR;
+}
+
+InterpretResult aotUndefined(Value* sp, int line, int slot) {
+    vm.stackTop = sp;
+    runtimeErrorAt(line, "Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot]));
+    return INTERPRET_RUNTIME_ERROR;
+}
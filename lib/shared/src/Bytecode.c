@@ -0,0 +1,487 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <shared/Bytecode.h>
+#include <shared/Memory.h>
+#include <shared/Object.h>
+#include <shared/VM.h>
+
+// Layout of a .loxb file, in the byte order of the machine that wrote it:
+//   BytecodeHeader
+//   code         codeCount bytes
+//   lines        lineCount LineStart, as laid out in memory
+//   constants    constantCount records: a ConstantTag byte, then 8 bytes of double for numbers, or a uint32_t length and the characters for strings
+//   globals      globalCount names: a uint32_t length and the characters, in slot order
+// Every section starts at a multiple of 8 bytes, so code and lines can be used in place once mapped.
+
+/// @brief Identifies a .loxb file.
+#define BYTECODE_MAGIC "LOXB"
+/// @brief Written as is in every file, to detect files from a machine with another byte order.
+#define BYTE_ORDER_MARK 0x01020304u
+
+/**
+ * @brief Header at the start of every .loxb file.
+ * @var BytecodeHeader::magic BYTECODE_MAGIC
+ * @var BytecodeHeader::version BYTECODE_VERSION
+ * @var BytecodeHeader::byteOrder BYTE_ORDER_MARK
+ * @var BytecodeHeader::size The size of the whole file
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t size;
+    uint32_t codeOffset;
+    uint32_t codeCount;
+    uint32_t linesOffset;
+    uint32_t lineCount;
+    uint32_t constantsOffset;
+    uint32_t constantCount;
+    uint32_t globalsOffset;
+    uint32_t globalCount;
+} BytecodeHeader;
+
+/// @brief Type of a constant record.
+typedef enum {
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE
+} ConstantTag;
+
+/**
+ * @brief A mapped .loxb file.
+ * @var BytecodeMapping::base The start of the mapping
+ * @var BytecodeMapping::size The size of the mapping
+ */
+struct BytecodeMapping {
+    uint8_t* base;
+    size_t size;
+};
+
+/**
+ * @brief A .loxb file being written.
+ * @var Output::count The number of bytes written
+ * @var Output::capacity The number of bytes the buffer can hold
+ * @var Output::bytes The bytes written
+ */
+typedef struct {
+    int count;
+    int capacity;
+    uint8_t* bytes;
+} Output;
+
+/**
+ * @brief A .loxb file being read. Every read is bounds checked, a read past the end sets ok to false and returns zeros.
+ * @var Input::bytes The file
+ * @var Input::size The size of the file
+ * @var Input::position The offset of the next byte to read
+ * @var Input::ok Whether every read so far was in bounds
+ */
+typedef struct {
+    const uint8_t* bytes;
+    size_t size;
+    size_t position;
+    bool ok;
+} Input;
+
+/// @brief Number of operation codes.
+#define OPCODE_PLUS_ONE(name, operandBytes, stackEffect) +1
+#define OPCODE_COUNT (0 FOR_EACH_OPCODE(OPCODE_PLUS_ONE))
+
+/// @brief Net number of Values each opcode pushes onto (or, if negative, pops off) the stack. Used to check files, which might not come from the compiler.
+static const int8_t stackEffects[] = {
+#define OPCODE_STACK_EFFECT(name, operands, stackEffect) [name] = stackEffect,
+    FOR_EACH_OPCODE(OPCODE_STACK_EFFECT)
+#undef OPCODE_STACK_EFFECT
+};
+
+static void writeBytes(Output* output, const void* bytes, size_t count) {
+    if (output->capacity < output->count + (int)count) {
+        int oldCapacity = output->capacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity < output->count + (int)count) {
+            capacity = GROW_CAPACITY(capacity);
+        }
+        output->bytes = GROW_ARRAY(uint8_t, output->bytes, oldCapacity, capacity);
+        output->capacity = capacity;
+    }
+    memcpy(output->bytes + output->count, bytes, count);
+    output->count += (int)count;
+}
+
+static void writeU32(Output* output, uint32_t value) {
+    writeBytes(output, &value, sizeof(value));
+}
+
+static void writeName(Output* output, ObjString* string) {
+    writeU32(output, (uint32_t)string->length);
+    writeBytes(output, string->chars, string->length);
+}
+
+/**
+ * @brief Pads the output to the next multiple of 8 bytes.
+ * @param output The output to pad
+ * @return The offset of the next section
+ */
+static uint32_t alignOutput(Output* output) {
+    static const uint8_t zeros[8] = {0};
+    writeBytes(output, zeros, (8 - output->count % 8) % 8);
+    return (uint32_t)output->count;
+}
+
+/**
+ * @brief Maps a quickened opcode back to the generic one it was written from.
+ * @param opcode The opcode
+ * @return The generic opcode, or opcode itself if it is not a quickened one
+ */
+static OpCode genericOpcode(OpCode opcode) {
+    switch (opcode) {
+    case OP_ADD_NUM_NUM:
+        return OP_ADD;
+    case OP_SUBTRACT_NUM_NUM:
+        return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM_NUM:
+        return OP_MULTIPLY;
+    case OP_DIVIDE_NUM_NUM:
+        return OP_DIVIDE;
+    case OP_GREATER_NUM:
+        return OP_GREATER;
+    case OP_LESS_NUM:
+        return OP_LESS;
+    case OP_GREATER_EQUAL_NUM:
+        return OP_GREATER_EQUAL;
+    case OP_LESS_EQUAL_NUM:
+        return OP_LESS_EQUAL;
+    case OP_NEGATE_NUM:
+        return OP_NEGATE;
+    default:
+        return opcode;
+    }
+}
+
+bool saveBytecode(Chunk* chunk, const char* path) {
+    Output output = {0, 0, NULL};
+    BytecodeHeader header;
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.version = BYTECODE_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    // Filled in last, once the sections have been laid out.
+    writeBytes(&output, &header, sizeof(header));
+
+    header.codeOffset = alignOutput(&output);
+    header.codeCount = (uint32_t)chunk->count;
+    for (int offset = 0; offset < chunk->count;) {
+        int length = instructionLength(chunk, offset);
+        uint8_t opcode = (uint8_t)genericOpcode((OpCode)chunk->code[offset]);
+        writeBytes(&output, &opcode, 1);
+        writeBytes(&output, chunk->code + offset + 1, length - 1);
+        offset += length;
+    }
+
+    header.linesOffset = alignOutput(&output);
+    header.lineCount = (uint32_t)chunk->lineCount;
+    writeBytes(&output, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+
+    header.constantsOffset = alignOutput(&output);
+    header.constantCount = (uint32_t)chunk->constants.count;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        uint8_t tag;
+        if (IS_NUMBER(constant)) {
+            tag = CONSTANT_NUMBER;
+            double number = AS_NUMBER(constant);
+            writeBytes(&output, &tag, 1);
+            writeBytes(&output, &number, sizeof(number));
+        } else if (IS_STRING(constant)) {
+            tag = CONSTANT_STRING;
+            writeBytes(&output, &tag, 1);
+            writeName(&output, AS_STRING(constant));
+        } else if (IS_NIL(constant)) {
+            tag = CONSTANT_NIL;
+            writeBytes(&output, &tag, 1);
+        } else if (IS_BOOL(constant)) {
+            tag = AS_BOOL(constant) ? CONSTANT_TRUE : CONSTANT_FALSE;
+            writeBytes(&output, &tag, 1);
+        } else {
+            fprintf(stderr, "Could not write \"%s\": constant %d cannot be serialized.\n", path, i);
+            FREE_ARRAY(uint8_t, output.bytes, output.capacity);
+            return false;
+        }
+    }
+
+    header.globalsOffset = alignOutput(&output);
+    header.globalCount = (uint32_t)vm.globalNames.count;
+    for (int slot = 0; slot < vm.globalNames.count; slot++) {
+        writeName(&output, AS_STRING(vm.globalNames.values[slot]));
+    }
+
+    header.size = (uint32_t)output.count;
+    memcpy(output.bytes, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    bool written = file != NULL && fwrite(output.bytes, 1, output.count, file) == (size_t)output.count;
+    if (file != NULL && fclose(file) != 0) {
+        written = false;
+    }
+    FREE_ARRAY(uint8_t, output.bytes, output.capacity);
+    if (!written) {
+        fprintf(stderr, "Could not write file \"%s\".\n", path);
+    }
+    return written;
+}
+
+static const uint8_t* readBytes(Input* input, size_t count) {
+    if (!input->ok || input->size - input->position < count) {
+        input->ok = false;
+        return NULL;
+    }
+    const uint8_t* bytes = input->bytes + input->position;
+    input->position += count;
+    return bytes;
+}
+
+static uint32_t readU32(Input* input) {
+    uint32_t value = 0;
+    const uint8_t* bytes = readBytes(input, sizeof(value));
+    if (bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+/**
+ * @brief Reads a length-prefixed string and interns it.
+ * @param input The input to read from
+ * @return The string, or NULL if the input is too short.
+ */
+static ObjString* readName(Input* input) {
+    uint32_t length = readU32(input);
+    const uint8_t* chars = readBytes(input, length);
+    if (chars == NULL || length > INT32_MAX) {
+        input->ok = false;
+        return NULL;
+    }
+    return copyString((const char*)chars, (int)length);
+}
+
+/**
+ * @brief Checks that a section lies within the file.
+ * @param header The header of the file
+ * @param offset The offset of the section
+ * @param size The size of the section
+ * @return Whether the section is in bounds.
+ */
+static bool sectionFits(BytecodeHeader* header, uint32_t offset, uint64_t size) {
+    return offset >= sizeof(BytecodeHeader) && (uint64_t)offset + size <= header->size;
+}
+
+/**
+ * @brief Checks the code of a loaded Chunk, and moves its global slot operands to the slots the names have in this VM.
+ * @param chunk The Chunk, with its code, lines and constants loaded
+ * @param slots The slot in this VM of each global of the file, by slot in the file
+ * @param globalCount The number of globals in the file
+ * @return A description of what is wrong, or NULL if the code is valid.
+ */
+static const char* checkCode(Chunk* chunk, int* slots, int globalCount) {
+    if (chunk->count == 0 || chunk->lineCount == 0 || chunk->lines[0].offset != 0) {
+        return "empty code or line table";
+    }
+
+    int depth = 0;
+    int offset = 0;
+    uint8_t last = OP_RETURN;
+    while (offset < chunk->count) {
+        uint8_t opcode = chunk->code[offset];
+        if (opcode >= OPCODE_COUNT) {
+            return "unknown opcode";
+        }
+        int length = instructionLength(chunk, offset);
+        if (offset + length > chunk->count) {
+            return "truncated instruction";
+        }
+        uint8_t* operands = chunk->code + offset + 1;
+
+        switch (opcode) {
+        case OP_CONSTANT:
+            if (operands[0] >= chunk->constants.count) {
+                return "constant out of range";
+            }
+            break;
+        case OP_CONSTANT_LONG:
+            if (((operands[0] << 16) | (operands[1] << 8) | operands[2]) >= chunk->constants.count) {
+                return "constant out of range";
+            }
+            break;
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_MULTIPLY_CONSTANT:
+        case OP_DIVIDE_CONSTANT:
+            // run() does not check the type of the constant of these, the optimizer only fuses numbers.
+            if (operands[0] >= chunk->constants.count || !IS_NUMBER(chunk->constants.values[operands[0]])) {
+                return "constant out of range";
+            }
+            break;
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL: {
+            int slot = (operands[0] << 8) | operands[1];
+            if (slot >= globalCount) {
+                return "global out of range";
+            }
+            if (slots[slot] != slot) {
+                operands[0] = (uint8_t)(slots[slot] >> 8);
+                operands[1] = (uint8_t)slots[slot];
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+        depth += stackEffects[opcode];
+        if (depth < 0) {
+            return "stack underflow";
+        }
+        last = opcode;
+        offset += length;
+    }
+
+    if (last != OP_RETURN) {
+        return "code does not end with OP_RETURN";
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reports why a file could not be loaded.
+ * @param path The path of the file
+ * @param reason What is wrong with it
+ * @return false, to be returned by the loader.
+ */
+static bool loadError(const char* path, const char* reason) {
+    fprintf(stderr, "Could not load \"%s\": %s.\n", path, reason);
+    return false;
+}
+
+bool loadBytecode(const char* path, Chunk* chunk) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(BytecodeHeader)) {
+        close(fd);
+        return loadError(path, "not a .loxb file");
+    }
+
+    // Private and writable: patching global slots and quickening write to the code, in copy-on-write pages that never reach the file.
+    size_t size = (size_t)status.st_size;
+    uint8_t* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        return false;
+    }
+    BytecodeMapping* mapping = ALLOCATE(BytecodeMapping, 1);
+    mapping->base = base;
+    mapping->size = size;
+    chunk->mapping = mapping;
+
+    BytecodeHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) != 0) {
+        return loadError(path, "not a .loxb file");
+    }
+    if (header.byteOrder != BYTE_ORDER_MARK) {
+        return loadError(path, "written on a machine with another byte order");
+    }
+    if (header.version != BYTECODE_VERSION) {
+        fprintf(stderr, "Could not load \"%s\": bytecode version %u, expected %d.\n", path, header.version, BYTECODE_VERSION);
+        return false;
+    }
+    if (header.size != size || !sectionFits(&header, header.codeOffset, header.codeCount) ||
+        !sectionFits(&header, header.linesOffset, (uint64_t)header.lineCount * sizeof(LineStart)) || header.linesOffset % _Alignof(LineStart) != 0 ||
+        !sectionFits(&header, header.constantsOffset, 0) || !sectionFits(&header, header.globalsOffset, 0) ||
+        header.codeCount > INT32_MAX || header.lineCount > INT32_MAX || header.globalCount > GLOBALS_MAX) {
+        return loadError(path, "truncated or corrupted file");
+    }
+
+    chunk->code = base + header.codeOffset;
+    chunk->count = (int)header.codeCount;
+    chunk->lines = (LineStart*)(base + header.linesOffset);
+    chunk->lineCount = (int)header.lineCount;
+
+    Input input = {base, size, header.constantsOffset, true};
+    for (uint32_t i = 0; i < header.constantCount && input.ok; i++) {
+        const uint8_t* tag = readBytes(&input, 1);
+        if (tag == NULL) {
+            break;
+        }
+        switch (*tag) {
+        case CONSTANT_NUMBER: {
+            double number = 0;
+            const uint8_t* bytes = readBytes(&input, sizeof(number));
+            if (bytes != NULL) {
+                memcpy(&number, bytes, sizeof(number));
+            }
+            writeValueArray(&chunk->constants, NUMBER_VAL(number));
+            break;
+        }
+        case CONSTANT_STRING: {
+            ObjString* string = readName(&input);
+            if (string != NULL) {
+                writeValueArray(&chunk->constants, OBJ_VAL(string));
+            }
+            break;
+        }
+        case CONSTANT_NIL:
+            writeValueArray(&chunk->constants, NIL_VAL);
+            break;
+        case CONSTANT_FALSE:
+        case CONSTANT_TRUE:
+            writeValueArray(&chunk->constants, BOOL_VAL(*tag == CONSTANT_TRUE));
+            break;
+        default:
+            input.ok = false;
+            break;
+        }
+    }
+    if (!input.ok) {
+        return loadError(path, "corrupted constants");
+    }
+
+    // The file's slots are those of the VM that compiled it. Here, the same names may already have other slots, or need new ones.
+    int* slots = ALLOCATE(int, header.globalCount);
+    input.position = header.globalsOffset;
+    for (uint32_t slot = 0; slot < header.globalCount; slot++) {
+        ObjString* name = readName(&input);
+        if (name == NULL) {
+            break;
+        }
+        slots[slot] = globalSlot(name);
+        if (slots[slot] >= GLOBALS_MAX) {
+            input.ok = false;
+            break;
+        }
+    }
+    const char* error = input.ok ? checkCode(chunk, slots, (int)header.globalCount) : "corrupted globals";
+    FREE_ARRAY(int, slots, header.globalCount);
+    if (error != NULL) {
+        return loadError(path, error);
+    }
+
+    chunk->maxStack = maxStackDepth(chunk);
+    return true;
+}
+
+void unmapBytecode(BytecodeMapping* mapping) {
+    if (mapping == NULL) {
+        return;
+    }
+    munmap(mapping->base, mapping->size);
+    FREE(BytecodeMapping, mapping);
+}
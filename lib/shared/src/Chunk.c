@@ -1,18 +1,50 @@
 #include <shared/Chunk.h>
+#include <shared/Bytecode.h>
+#include <shared/Jit.h>
 #include <shared/Memory.h>
 
+/// @brief Number of bytes of operands following each opcode.
+static const uint8_t operandBytes[] = {
+#define OPCODE_OPERANDS(name, operands, stackEffect) [name] = operands,
+    FOR_EACH_OPCODE(OPCODE_OPERANDS)
+#undef OPCODE_OPERANDS
+};
+
+/// @brief Net number of Values each opcode pushes onto (or, if negative, pops off) the stack.
+static const int8_t stackEffects[] = {
+#define OPCODE_STACK_EFFECT(name, operands, stackEffect) [name] = stackEffect,
+    FOR_EACH_OPCODE(OPCODE_STACK_EFFECT)
+#undef OPCODE_STACK_EFFECT
+};
+
 void initChunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
-    chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->constantIndex.capacity = 0;
+    chunk->constantIndex.slots = NULL;
+    chunk->maxStack = 0;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
+    chunk->lines = NULL;
+    chunk->invocations = 0;
+    chunk->jit = NULL;
+    chunk->mapping = NULL;
 }
 
 void freeChunk(Chunk* chunk) {
+    if (chunk->mapping != NULL) {
+        // Code and lines belong to the mapping, not to the allocator.
+        chunk->code = NULL;
+        chunk->lines = NULL;
+        unmapBytecode(chunk->mapping);
+    }
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(int, chunk->constantIndex.slots, chunk->constantIndex.capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    freeJit(chunk->jit);
     initChunk(chunk);
 }
 
@@ -21,14 +53,206 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
     }
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    // Still on the same line, the current run already covers this byte.
+    if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
+        return;
+    }
+
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        int oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+    }
+    LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+    lineStart->offset = chunk->count - 1;
+    lineStart->line = line;
+}
+
+int getLine(Chunk* chunk, int offset) {
+    // Find the last run starting at or before the offset.
+    int low = 0;
+    int high = chunk->lineCount - 1;
+
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return chunk->lines[low].line;
+}
+
+/**
+ * @brief Checks if two constants are the same. Stricter than valuesEqual(), numbers must have the exact same bits.
+ * @param a The first constant
+ * @param b The second constant
+ * @return Whether the constants can share a slot in the constant pool
+ */
+static bool sameConstant(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    if (a.type != b.type) {
+        return false;
+    }
+
+    switch (a.type) {
+    case VAL_BOOL:
+        return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_NIL:
+    case VAL_UNDEFINED:
+        return true;
+    case VAL_NUMBER:
+        return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+    case VAL_OBJ:
+        return AS_OBJ(a) == AS_OBJ(b);
+    }
+    return false; // Unreachable.
+#endif
+}
+
+/**
+ * @brief Hashes a constant, consistently with sameConstant()
+ * @param value The constant to hash
+ * @return The hash of the constant
+ */
+static uint32_t hashConstant(Value value) {
+    uint64_t bits;
+#ifdef NAN_BOXING
+    bits = value;
+#else
+    switch (value.type) {
+    case VAL_BOOL:
+        bits = AS_BOOL(value);
+        break;
+    case VAL_NUMBER:
+        memcpy(&bits, &value.as.number, sizeof(double));
+        break;
+    case VAL_OBJ:
+        bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+        break;
+    default:
+        bits = 0;
+        break;
+    }
+#endif
+    // Mix the bits, small integers only differ in the high bits of their double representation.
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+/**
+ * @brief Finds the slot of the index holding the given constant, or the empty slot where it would go
+ * @param chunk The chunk owning the index
+ * @param value The constant to look for
+ * @return The slot, in the index, for the constant
+ */
+static int findConstantSlot(Chunk* chunk, Value value) {
+    ConstantIndex* index = &chunk->constantIndex;
+    int slot = hashConstant(value) & (index->capacity - 1);
+
+    for (;;) {
+        int constant = index->slots[slot];
+        if (constant == -1 || sameConstant(chunk->constants.values[constant], value)) {
+            return slot;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+}
+
+/**
+ * @brief Grows the index and re-inserts every constant of the pool into it
+ * @param chunk The chunk owning the index
+ */
+static void growConstantIndex(Chunk* chunk) {
+    ConstantIndex* index = &chunk->constantIndex;
+    int oldCapacity = index->capacity;
+    index->capacity = GROW_CAPACITY(oldCapacity);
+    index->slots = GROW_ARRAY(int, index->slots, oldCapacity, index->capacity);
+
+    for (int slot = 0; slot < index->capacity; slot++) {
+        index->slots[slot] = -1;
+    }
+    for (int constant = 0; constant < chunk->constants.count; constant++) {
+        index->slots[findConstantSlot(chunk, chunk->constants.values[constant])] = constant;
+    }
+}
+
+/**
+ * @brief Removes a constant from the index. Entries after it in the same probe sequence are shifted back, so no tombstones are needed.
+ * @param chunk The chunk owning the index
+ * @param constant The index, in the constant pool, of the constant to remove
+ */
+static void removeConstantFromIndex(Chunk* chunk, int constant) {
+    ConstantIndex* index = &chunk->constantIndex;
+    int mask = index->capacity - 1;
+    int hole = findConstantSlot(chunk, chunk->constants.values[constant]);
+    index->slots[hole] = -1;
+
+    for (int slot = (hole + 1) & mask; index->slots[slot] != -1; slot = (slot + 1) & mask) {
+        int home = hashConstant(chunk->constants.values[index->slots[slot]]) & mask;
+        // Move the entry into the hole unless its home slot lies cyclically between the hole and its current slot.
+        bool reachable = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+        if (!reachable) {
+            index->slots[hole] = index->slots[slot];
+            index->slots[slot] = -1;
+            hole = slot;
+        }
+    }
 }
 
 int addConstant(Chunk* chunk, Value value) {
+    // Keep the index at most half full.
+    if (chunk->constantIndex.capacity < (chunk->constants.count + 1) * 2) {
+        growConstantIndex(chunk);
+    }
+
+    int slot = findConstantSlot(chunk, value);
+    if (chunk->constantIndex.slots[slot] != -1) {
+        return chunk->constantIndex.slots[slot];
+    }
+
     writeValueArray(&chunk->constants, value);
+    chunk->constantIndex.slots[slot] = chunk->constants.count - 1;
     return chunk->constants.count - 1;
 }
+
+void truncateChunk(Chunk* chunk, int count, int constantCount) {
+    chunk->count = count;
+    while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= count) {
+        chunk->lineCount--;
+    }
+    while (chunk->constants.count > constantCount) {
+        removeConstantFromIndex(chunk, chunk->constants.count - 1);
+        chunk->constants.count--;
+    }
+}
+
+int instructionLength(Chunk* chunk, int offset) {
+    return 1 + operandBytes[chunk->code[offset]];
+}
+
+int maxStackDepth(Chunk* chunk) {
+    // There are no jumps yet, so every instruction is reached exactly once, in order, with a known depth.
+    // No instruction pushes before it pops, so the depth in between instructions is all that matters.
+    int depth = 0;
+    int maxDepth = 0;
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        depth += stackEffects[chunk->code[offset]];
+        if (depth > maxDepth) {
+            maxDepth = depth;
+        }
+    }
+
+    return maxDepth;
+}
@@ -1,5 +1,7 @@
 #include <shared/common.h>
 #include <shared/Compiler.h>
+#include <shared/Object.h>
+#include <shared/Optimizer.h>
 #include <shared/Scanner.h>
 #include <shared/VM.h>
 
@@ -10,6 +12,12 @@
 Parser parser;
 Chunk* compilingChunk;
 
+/// @brief Where the left operand of the infix expression currently being compiled starts. Set by parsePrecedence() right before calling an infix rule.
+Operand infixOperand;
+
+/// @brief Whether the prefix expression about to be compiled can be the target of an assignment. Set by parsePrecedence() right before calling a prefix rule.
+bool canAssign;
+
 /// @brief Gets the current chunk being compiled
 /// @return The current chunk being compiled
 static Chunk* currentChunk() {
@@ -84,6 +92,28 @@ static void consume(TokenType type, const char* message) {
     errorAtCurrent(message);
 }
 
+/**
+ * @brief Checks if the current token is of the given type, without consuming it.
+ * @param type The type of token to check for
+ * @return Whether the current token is of the given type
+ */
+static bool check(TokenType type) {
+    return parser.current.type == type;
+}
+
+/**
+ * @brief Consumes the current token if it is of the given type.
+ * @param type The type of token to match
+ * @return Whether the token was consumed
+ */
+static bool match(TokenType type) {
+    if (!check(type)) {
+        return false;
+    }
+    advance();
+    return true;
+}
+
 /**
  * @brief Emits a byte to the current chunk
  * @param byte The byte to emit
@@ -92,27 +122,37 @@ static void emitByte(uint8_t byte) {
     writeChunk(currentChunk(), byte, parser.previous.line);
 }
 
+/**
+ * @brief Emits an instruction on a global variable, with its 2 byte slot operand
+ * @param opcode The instruction
+ * @param slot The slot of the global variable
+ */
+static void emitGlobal(OpCode opcode, int slot) {
+    emitByte(opcode);
+    emitByte((uint8_t)((slot >> 8) & 0xff));
+    emitByte((uint8_t)(slot & 0xff));
+}
+
 /// @brief Emits an OP_RETURN instruction to the current chunk
 static void emitReturn() {
     emitByte(OP_RETURN);
 }
 
 /**
- * @brief Compiles a constant value into the current chunk
- * @param value The value to compile
+ * @brief Adds a constant value to the current chunk, reusing its slot if the value is already there
+ * @param value The value to add
  * @return The index of the constant in the chunk
  */
-static uint8_t makeConstant(Value value) {
+static int makeConstant(Value value) {
     int constant = addConstant(currentChunk(), value);
 
-    if (constant > UINT8_MAX) {
-        // Since the OP_CONSTANT instruction uses a single byte for the index operand, we can store and load only up to 256 constants in a chunk.
-        // TODO: Implement a solution for this
+    if (constant >= CONSTANTS_MAX) {
+        // OP_CONSTANT_LONG uses 3 bytes for the index operand, so that's as many constants as a chunk can reference.
         error("Too many constants in one chunk.");
         return 0;
     }
 
-    return (uint8_t)constant;
+    return constant;
 }
 
 /**
@@ -120,14 +160,181 @@ static uint8_t makeConstant(Value value) {
  * @param value The value to compile
  */
 static void emitConstant(Value value) {
-    emitByte(OP_CONSTANT);
-    emitByte(makeConstant(value));
+    int constant = makeConstant(value);
+
+    if (constant <= CONSTANT_SHORT_MAX) {
+        emitByte(OP_CONSTANT);
+        emitByte((uint8_t)constant);
+        return;
+    }
+
+    emitByte(OP_CONSTANT_LONG);
+    emitByte((uint8_t)((constant >> 16) & 0xff));
+    emitByte((uint8_t)((constant >> 8) & 0xff));
+    emitByte((uint8_t)(constant & 0xff));
+}
+
+/**
+ * @brief Emits the cheapest instruction that pushes the given value
+ * @param value The value to push
+ */
+static void emitValue(Value value) {
+    if (IS_NIL(value)) {
+        emitByte(OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(value);
+    }
+}
+
+/**
+ * @brief Marks the current end of the chunk as the start of an operand
+ * @return The start of the next operand to be compiled
+ */
+static Operand markOperand() {
+    Operand operand;
+    operand.code = currentChunk()->count;
+    operand.constants = currentChunk()->constants.count;
+    return operand;
+}
+
+/**
+ * @brief Checks if the code between the start of an operand and the given offset is a single instruction pushing a constant
+ * @param operand The start of the operand
+ * @param end The offset right after the operand's last instruction
+ * @param value Where to store the constant, if it is one
+ * @return Whether the operand is a constant
+ */
+static bool constantOperand(Operand operand, int end, Value* value) {
+    Chunk* chunk = currentChunk();
+    int length = end - operand.code;
+
+    if (length == 1) {
+        switch (chunk->code[operand.code]) {
+        case OP_NIL:
+            *value = NIL_VAL;
+            return true;
+        case OP_TRUE:
+            *value = BOOL_VAL(true);
+            return true;
+        case OP_FALSE:
+            *value = BOOL_VAL(false);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    if (length == 2 && chunk->code[operand.code] == OP_CONSTANT) {
+        *value = chunk->constants.values[chunk->code[operand.code + 1]];
+        return true;
+    }
+
+    if (length == 4 && chunk->code[operand.code] == OP_CONSTANT_LONG) {
+        uint8_t* bytes = &chunk->code[operand.code + 1];
+        *value = chunk->constants.values[(bytes[0] << 16) | (bytes[1] << 8) | bytes[2]];
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Evaluates a binary operator at compile time, as long as the VM would not report an error for it
+ * @param operatorType The operator
+ * @param a The left operand
+ * @param b The right operand
+ * @param result Where to store the result, if it could be computed
+ * @return Whether the operator could be evaluated
+ */
+static bool foldBinary(TokenType operatorType, Value a, Value b, Value* result) {
+    switch (operatorType) {
+    case TOKEN_BANG_EQUAL:
+        *result = BOOL_VAL(!valuesEqual(a, b));
+        return true;
+    case TOKEN_EQUAL_EQUAL:
+        *result = BOOL_VAL(valuesEqual(a, b));
+        return true;
+    default:
+        break;
+    }
+
+    if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        *result = OBJ_VAL(concatenateStrings(AS_STRING(a), AS_STRING(b)));
+        return true;
+    }
+
+    // Every other operator raises an error at runtime otherwise, so leave those for the VM.
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+        return false;
+    }
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (operatorType) {
+    case TOKEN_GREATER:
+        *result = BOOL_VAL(x > y);
+        return true;
+    case TOKEN_GREATER_EQUAL:
+        *result = BOOL_VAL(!(x < y));
+        return true;
+    case TOKEN_LESS:
+        *result = BOOL_VAL(x < y);
+        return true;
+    case TOKEN_LESS_EQUAL:
+        *result = BOOL_VAL(!(x > y));
+        return true;
+    case TOKEN_PLUS:
+        *result = NUMBER_VAL(x + y);
+        return true;
+    case TOKEN_MINUS:
+        *result = NUMBER_VAL(x - y);
+        return true;
+    case TOKEN_STAR:
+        *result = NUMBER_VAL(x * y);
+        return true;
+    case TOKEN_SLASH:
+        *result = NUMBER_VAL(x / y);
+        return true;
+    default:
+        return false; // Unreachable.
+    }
+}
+
+/**
+ * @brief Evaluates a unary operator at compile time, as long as the VM would not report an error for it
+ * @param operatorType The operator
+ * @param operand The operand
+ * @param result Where to store the result, if it could be computed
+ * @return Whether the operator could be evaluated
+ */
+static bool foldUnary(TokenType operatorType, Value operand, Value* result) {
+    switch (operatorType) {
+    case TOKEN_BANG:
+        *result = BOOL_VAL(isFalsey(operand));
+        return true;
+    case TOKEN_MINUS:
+        if (!IS_NUMBER(operand)) {
+            return false;
+        }
+        *result = NUMBER_VAL(-AS_NUMBER(operand));
+        return true;
+    default:
+        return false; // Unreachable.
+    }
 }
 
 /// @brief Finalizes the bytecode for the current chunk being compiled
 static void endCompiler() {
     emitReturn();
 
+    if (!parser.hadError) {
+        optimizeChunk(currentChunk());
+        currentChunk()->maxStack = maxStackDepth(currentChunk());
+    }
+
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
         disassembleChunk(currentChunk(), "code");
@@ -135,9 +342,15 @@ static void endCompiler() {
 #endif
 }
 
-/// @brief Parses a number in the source code.
+/// @brief Parses an expression in the source code.
 static void expression();
 
+/// @brief Parses a statement in the source code.
+static void statement();
+
+/// @brief Parses a declaration in the source code.
+static void declaration();
+
 /**
  * @brief Given a token type, returns the corresponding parse rule
  * @param type The token type
@@ -155,8 +368,21 @@ static void parsePrecedence(Precedence precedence);
 static void binary() {
     TokenType operatorType = parser.previous.type;
     ParseRule* rule = getRule(operatorType);
+    Operand left = infixOperand;
+    Operand right = markOperand();
     parsePrecedence((Precedence)(rule->precedence + 1));
 
+    // When both operands are constants, replace their instructions (and constants) with the result.
+    Value a;
+    Value b;
+    Value result;
+    if (constantOperand(left, right.code, &a) && constantOperand(right, currentChunk()->count, &b) &&
+        foldBinary(operatorType, a, b, &result)) {
+        truncateChunk(currentChunk(), left.code, left.constants);
+        emitValue(result);
+        return;
+    }
+
     switch (operatorType) {
     case TOKEN_BANG_EQUAL:
         emitByte(OP_EQUAL);
@@ -219,17 +445,137 @@ static void number() {
     emitConstant(NUMBER_VAL(value));
 }
 
+/// @brief Parses a string literal in the source code. The string is interned right away, so the VM never has to.
+static void string() {
+    // Trim the surrounding quotes.
+    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+}
+
+/**
+ * @brief Resolves the name of a global variable to its slot. Globals are never looked up by name at runtime.
+ * @param name The identifier token of the variable
+ * @return The slot of the variable
+ */
+static int globalVariable(Token* name) {
+    int slot = globalSlot(copyString(name->start, name->length));
+
+    if (slot >= GLOBALS_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return slot;
+}
+
+/// @brief Parses a variable access, or an assignment to it, in the source code.
+static void variable() {
+    // Read canAssign before anything else is parsed, nested expressions overwrite it.
+    bool assignable = canAssign;
+    int slot = globalVariable(&parser.previous);
+
+    if (assignable && match(TOKEN_EQUAL)) {
+        expression();
+        emitGlobal(OP_SET_GLOBAL, slot);
+    } else {
+        emitGlobal(OP_GET_GLOBAL, slot);
+    }
+}
+
 static void expression() {
     parsePrecedence(PREC_ASSIGNMENT);
 }
 
+/// @brief Parses a variable declaration ("var name = value;") in the source code. Variables without an initializer start as nil.
+static void varDeclaration() {
+    consume(TOKEN_IDENTIFIER, "Expect variable name.");
+    int slot = globalVariable(&parser.previous);
+
+    if (match(TOKEN_EQUAL)) {
+        expression();
+    } else {
+        emitByte(OP_NIL);
+    }
+    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+    emitGlobal(OP_DEFINE_GLOBAL, slot);
+}
+
+/// @brief Parses an expression statement in the source code. The value of the expression is discarded.
+static void expressionStatement() {
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emitByte(OP_POP);
+}
+
+/// @brief Parses a print statement in the source code.
+static void printStatement() {
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
+    emitByte(OP_PRINT);
+}
+
+/// @brief Skips tokens until a statement boundary, so a single syntax error doesn't cascade into more.
+static void synchronize() {
+    parser.panicMode = false;
+
+    while (parser.current.type != TOKEN_EOF) {
+        if (parser.previous.type == TOKEN_SEMICOLON) {
+            return;
+        }
+        switch (parser.current.type) {
+        case TOKEN_CLASS:
+        case TOKEN_FUN:
+        case TOKEN_VAR:
+        case TOKEN_FOR:
+        case TOKEN_IF:
+        case TOKEN_WHILE:
+        case TOKEN_PRINT:
+        case TOKEN_RETURN:
+            return;
+        default:
+            break;
+        }
+
+        advance();
+    }
+}
+
+static void declaration() {
+    if (match(TOKEN_VAR)) {
+        varDeclaration();
+    } else {
+        statement();
+    }
+
+    if (parser.panicMode) {
+        synchronize();
+    }
+}
+
+static void statement() {
+    if (match(TOKEN_PRINT)) {
+        printStatement();
+    } else {
+        expressionStatement();
+    }
+}
+
 /// @brief Parses a unary expression in the source code.
 static void unary() {
     TokenType operatorType = parser.previous.type;
 
     // Compile the operand.
+    Operand operand = markOperand();
     parsePrecedence(PREC_UNARY);
 
+    Value value;
+    Value result;
+    if (constantOperand(operand, currentChunk()->count, &value) && foldUnary(operatorType, value, &result)) {
+        truncateChunk(currentChunk(), operand.code, operand.constants);
+        emitValue(result);
+        return;
+    }
+
     switch (operatorType) {
     case TOKEN_BANG:
         emitByte(OP_NOT);
@@ -251,13 +597,22 @@ static void parsePrecedence(Precedence precedence) {
         return;
     }
 
+    // Only a low precedence expression can be assigned to, "a * b = c" must not be compiled as "a * (b = c)".
+    bool assignable = precedence <= PREC_ASSIGNMENT;
+    Operand left = markOperand();
+    canAssign = assignable;
     prefixRule();
 
     while (precedence <= getRule(parser.current.type)->precedence) {
         advance();
         ParseFn infixRule = getRule(parser.previous.type)->infix;
+        infixOperand = left;
         infixRule();
     }
+
+    if (assignable && match(TOKEN_EQUAL)) {
+        error("Invalid assignment target.");
+    }
 }
 
 /// @brief Parses a grouping expression ("(" and ")") in the source code.
@@ -287,8 +642,8 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = { NULL,    binary, PREC_EQUALITY},
     [TOKEN_LESS] = { NULL,    binary, PREC_EQUALITY},
     [TOKEN_LESS_EQUAL] = { NULL,    binary, PREC_EQUALITY},
-    [TOKEN_IDENTIFIER] = { NULL,    NULL,   PREC_NONE    },
-    [TOKEN_STRING] = { NULL,    NULL,   PREC_NONE    },
+    [TOKEN_IDENTIFIER] = { variable, NULL,   PREC_NONE    },
+    [TOKEN_STRING] = { string,  NULL,   PREC_NONE    },
     [TOKEN_NUMBER] = { number,  NULL,   PREC_NONE    },
     [TOKEN_AND] = { NULL,    NULL,   PREC_NONE    },
     [TOKEN_CLASS] = { NULL,    NULL,   PREC_NONE    },
@@ -323,8 +678,9 @@ bool compile(const char* source, Chunk* chunk) {
     parser.panicMode = false;
 
     advance();
-    expression();
-    consume(TOKEN_EOF, "Expect end of expression.");
+    while (!match(TOKEN_EOF)) {
+        declaration();
+    }
 
     endCompiler();
 
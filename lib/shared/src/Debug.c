@@ -1,4 +1,6 @@
 #include <shared/Debug.h>
+#include <shared/Object.h>
+#include <shared/VM.h>
 
 /**
  * @brief Static function for printing a constant value, fetching the value from a Chunk's Constant Pool.
@@ -15,6 +17,37 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2; // +1 for the opcode +1 for the constant
 }
 
+/**
+ * @brief Static function for printing a constant value with a 3 byte index, fetching the value from a Chunk's Constant Pool.
+ * @param name Instruction name
+ * @param chunk The Chunk to fetch the constant from
+ * @param offset Byte offset of the constant
+ * @return The offset of the next instruction.
+ */
+static int constantLongInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t* bytes = &chunk->code[offset + 1];
+    int constant = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4; // +1 for the opcode +3 for the constant
+}
+
+/**
+ * @brief Static function for printing an instruction on a global variable, with the variable's slot and name.
+ * @param name Instruction name
+ * @param chunk The Chunk the instruction is in
+ * @param offset Byte offset of the instruction
+ * @return The offset of the next instruction.
+ */
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+    int slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    printf("%-16s %4d '", name, slot);
+    printValue(vm.globalNames.values[slot]);
+    printf("'\n");
+    return offset + 3; // +1 for the opcode +2 for the slot
+}
+
 /**
  * @brief Static function for printing a simple instruction.
  * @param name Instruction name
@@ -35,10 +68,11 @@ void disassembleChunk(Chunk* chunk, const char* name) {
 
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    int line = getLine(chunk, offset);
+    if (offset > 0 && line == getLine(chunk, offset - 1)) {
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -46,6 +80,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
     switch (instruction) {
     case OP_CONSTANT:
         return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_CONSTANT_LONG:
+        return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
     case OP_NIL:
         return simpleInstruction("OP_NIL", offset);
     case OP_TRUE:
@@ -70,8 +106,50 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         return simpleInstruction("OP_NOT", offset);
     case OP_NEGATE:
         return simpleInstruction("OP_NEGATE", offset);
+    case OP_PRINT:
+        return simpleInstruction("OP_PRINT", offset);
+    case OP_POP:
+        return simpleInstruction("OP_POP", offset);
+    case OP_DEFINE_GLOBAL:
+        return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+    case OP_GET_GLOBAL:
+        return globalInstruction("OP_GET_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:
+        return globalInstruction("OP_SET_GLOBAL", chunk, offset);
     case OP_RETURN:
         return simpleInstruction("OP_RETURN", offset);
+    case OP_NOT_EQUAL:
+        return simpleInstruction("OP_NOT_EQUAL", offset);
+    case OP_GREATER_EQUAL:
+        return simpleInstruction("OP_GREATER_EQUAL", offset);
+    case OP_LESS_EQUAL:
+        return simpleInstruction("OP_LESS_EQUAL", offset);
+    case OP_ADD_CONSTANT:
+        return constantInstruction("OP_ADD_CONSTANT", chunk, offset);
+    case OP_SUBTRACT_CONSTANT:
+        return constantInstruction("OP_SUBTRACT_CONSTANT", chunk, offset);
+    case OP_MULTIPLY_CONSTANT:
+        return constantInstruction("OP_MULTIPLY_CONSTANT", chunk, offset);
+    case OP_DIVIDE_CONSTANT:
+        return constantInstruction("OP_DIVIDE_CONSTANT", chunk, offset);
+    case OP_ADD_NUM_NUM:
+        return simpleInstruction("OP_ADD_NUM_NUM", offset);
+    case OP_SUBTRACT_NUM_NUM:
+        return simpleInstruction("OP_SUBTRACT_NUM_NUM", offset);
+    case OP_MULTIPLY_NUM_NUM:
+        return simpleInstruction("OP_MULTIPLY_NUM_NUM", offset);
+    case OP_DIVIDE_NUM_NUM:
+        return simpleInstruction("OP_DIVIDE_NUM_NUM", offset);
+    case OP_GREATER_NUM:
+        return simpleInstruction("OP_GREATER_NUM", offset);
+    case OP_LESS_NUM:
+        return simpleInstruction("OP_LESS_NUM", offset);
+    case OP_GREATER_EQUAL_NUM:
+        return simpleInstruction("OP_GREATER_EQUAL_NUM", offset);
+    case OP_LESS_EQUAL_NUM:
+        return simpleInstruction("OP_LESS_EQUAL_NUM", offset);
+    case OP_NEGATE_NUM:
+        return simpleInstruction("OP_NEGATE_NUM", offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
@@ -79,15 +157,13 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 }
 
 void printValue(Value value) {
-    switch (value.type) {
-    case VAL_BOOL:
+    if (IS_BOOL(value)) {
         printf(AS_BOOL(value) ? "true" : "false");
-        break;
-    case VAL_NIL:
+    } else if (IS_NIL(value)) {
         printf("nil");
-        break;
-    case VAL_NUMBER:
+    } else if (IS_NUMBER(value)) {
         printf("%g", AS_NUMBER(value));
-        break;
+    } else if (IS_OBJ(value)) {
+        printObject(value);
     }
 }
@@ -0,0 +1,356 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <shared/Image.h>
+#include <shared/Memory.h>
+#include <shared/Object.h>
+#include <shared/VM.h>
+
+// Layout of an image, in the byte order of the machine that wrote it:
+//   ImageHeader
+//   strings      stringCount ObjStrings, header and characters, exactly as in memory (with Obj::next cleared), each starting at a multiple of 8 bytes
+//   globals      globalCount ImageGlobal, in slot order
+// Nothing in the image is an absolute address: globals refer to strings by index, so the image can be mapped anywhere.
+
+/// @brief Identifies an image file.
+#define IMAGE_MAGIC "LOXI"
+/// @brief Written as is in every image, to detect images from a machine with another byte order.
+#define IMAGE_BYTE_ORDER_MARK 0x01020304u
+
+/**
+ * @brief Header at the start of every image.
+ * @var ImageHeader::magic IMAGE_MAGIC
+ * @var ImageHeader::version IMAGE_VERSION
+ * @var ImageHeader::byteOrder IMAGE_BYTE_ORDER_MARK
+ * @var ImageHeader::stringSize sizeof(ObjString) in the VM that wrote the image. Strings are mapped in place, so it has to match
+ * @var ImageHeader::size The size of the whole file
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t stringSize;
+    uint64_t size;
+    uint64_t stringsOffset;
+    uint64_t globalsOffset;
+    uint32_t stringCount;
+    uint32_t globalCount;
+} ImageHeader;
+
+/// @brief Type of the value of a global in an image.
+typedef enum {
+    IMAGE_UNDEFINED,
+    IMAGE_NIL,
+    IMAGE_FALSE,
+    IMAGE_TRUE,
+    IMAGE_NUMBER,
+    IMAGE_STRING
+} ImageValueTag;
+
+/**
+ * @brief A global variable in an image.
+ * @var ImageGlobal::name The index of its name among the strings of the image
+ * @var ImageGlobal::tag The type of its value, an ImageValueTag
+ * @var ImageGlobal::payload The bits of the number for IMAGE_NUMBER, the index of the string for IMAGE_STRING, 0 otherwise
+ */
+typedef struct {
+    uint32_t name;
+    uint32_t tag;
+    uint64_t payload;
+} ImageGlobal;
+
+/**
+ * @brief A mapped image.
+ * @var ImageMapping::base The start of the mapping
+ * @var ImageMapping::size The size of the mapping
+ */
+struct ImageMapping {
+    uint8_t* base;
+    size_t size;
+};
+
+/**
+ * @brief An image being written.
+ * @var ImageOutput::count The number of bytes written
+ * @var ImageOutput::capacity The number of bytes the buffer can hold
+ * @var ImageOutput::bytes The bytes written
+ */
+typedef struct {
+    size_t count;
+    size_t capacity;
+    uint8_t* bytes;
+} ImageOutput;
+
+static void writeBytes(ImageOutput* output, const void* bytes, size_t count) {
+    if (output->capacity < output->count + count) {
+        size_t oldCapacity = output->capacity;
+        size_t capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity < output->count + count) {
+            capacity = GROW_CAPACITY(capacity);
+        }
+        output->bytes = GROW_ARRAY(uint8_t, output->bytes, oldCapacity, capacity);
+        output->capacity = capacity;
+    }
+    memcpy(output->bytes + output->count, bytes, count);
+    output->count += count;
+}
+
+/**
+ * @brief Pads the output to the next multiple of 8 bytes.
+ * @param output The output to pad
+ * @return The offset of what comes next
+ */
+static uint64_t alignOutput(ImageOutput* output) {
+    static const uint8_t zeros[8] = {0};
+    writeBytes(output, zeros, (8 - output->count % 8) % 8);
+    return output->count;
+}
+
+/**
+ * @brief Converts the value of a global into its image form.
+ * @param value The value. Ropes have been flattened already
+ * @param indexes The index in the image of every interned string, as a number Value
+ * @param global The image global to fill
+ */
+static void saveValue(Value value, Table* indexes, ImageGlobal* global) {
+    global->payload = 0;
+    if (IS_UNDEFINED(value)) {
+        global->tag = IMAGE_UNDEFINED;
+    } else if (IS_NIL(value)) {
+        global->tag = IMAGE_NIL;
+    } else if (IS_BOOL(value)) {
+        global->tag = AS_BOOL(value) ? IMAGE_TRUE : IMAGE_FALSE;
+    } else if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        global->tag = IMAGE_NUMBER;
+        memcpy(&global->payload, &number, sizeof(number));
+    } else {
+        Value index;
+        tableGet(indexes, AS_STRING(value), &index);
+        global->tag = IMAGE_STRING;
+        global->payload = (uint64_t)AS_NUMBER(index);
+    }
+}
+
+bool saveImage(const char* path) {
+    // Flattening interns new strings, so it has to be done before the strings are written.
+    for (int slot = 0; slot < vm.globalValues.count; slot++) {
+        Value value = vm.globalValues.values[slot];
+        if (IS_ROPE(value)) {
+            vm.globalValues.values[slot] = OBJ_VAL(flattenRope((ObjRope*)AS_OBJ(value)));
+        }
+    }
+
+    ImageOutput output = {0, 0, NULL};
+    ImageHeader header;
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byteOrder = IMAGE_BYTE_ORDER_MARK;
+    header.stringSize = sizeof(ObjString);
+    // Filled in last, once the sections have been laid out.
+    writeBytes(&output, &header, sizeof(header));
+
+    Table indexes;
+    initTable(&indexes);
+    header.stringsOffset = alignOutput(&output);
+    header.stringCount = 0;
+    for (int i = 0; i < vm.strings.capacity; i++) {
+        ObjString* string = vm.strings.entries[i].key;
+        if (string == NULL) {
+            continue;
+        }
+        tableSet(&indexes, string, NUMBER_VAL(header.stringCount++));
+
+        alignOutput(&output);
+        size_t offset = output.count;
+        writeBytes(&output, string, STRING_SIZE(string->length));
+        // The list of objects is the VM's own, mapped strings are never on it. They are never freed either, so they are saved marked for good.
+        Obj* object = (Obj*)(output.bytes + offset);
+        object->next = NULL;
+        object->isMarked = true;
+    }
+
+    header.globalsOffset = alignOutput(&output);
+    header.globalCount = (uint32_t)vm.globalNames.count;
+    for (int slot = 0; slot < vm.globalNames.count; slot++) {
+        ImageGlobal global;
+        Value index;
+        tableGet(&indexes, AS_STRING(vm.globalNames.values[slot]), &index);
+        global.name = (uint32_t)AS_NUMBER(index);
+        saveValue(vm.globalValues.values[slot], &indexes, &global);
+        writeBytes(&output, &global, sizeof(global));
+    }
+    freeTable(&indexes);
+
+    header.size = output.count;
+    memcpy(output.bytes, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    bool written = file != NULL && fwrite(output.bytes, 1, output.count, file) == output.count;
+    if (file != NULL && fclose(file) != 0) {
+        written = false;
+    }
+    FREE_ARRAY(uint8_t, output.bytes, output.capacity);
+    if (!written) {
+        fprintf(stderr, "Could not write file \"%s\".\n", path);
+    }
+    return written;
+}
+
+/**
+ * @brief Reports why an image could not be loaded.
+ * @param path The path of the image
+ * @param reason What is wrong with it
+ * @return false, to be returned by the loader.
+ */
+static bool imageError(const char* path, const char* reason) {
+    fprintf(stderr, "Could not load image \"%s\": %s.\n", path, reason);
+    return false;
+}
+
+/**
+ * @brief Adds the strings of a mapped image to the intern table.
+ * @param header The header of the image
+ * @param base The start of the mapping
+ * @param strings Receives the address of every string, by index
+ * @return Whether every string is within the strings section and well formed.
+ */
+static bool loadStrings(ImageHeader* header, uint8_t* base, ObjString** strings) {
+    uint64_t offset = header->stringsOffset;
+    for (uint32_t i = 0; i < header->stringCount; i++) {
+        offset = (offset + 7) & ~(uint64_t)7;
+        if (header->globalsOffset < offset || header->globalsOffset - offset < sizeof(ObjString)) {
+            return false;
+        }
+        ObjString* string = (ObjString*)(base + offset);
+        if (string->obj.type != OBJ_STRING || string->length < 0 || header->globalsOffset - offset < STRING_SIZE(string->length) ||
+            string->chars[string->length] != '\0') {
+            return false;
+        }
+        tableSet(&vm.strings, string, NIL_VAL);
+        strings[i] = string;
+        offset += STRING_SIZE(string->length);
+    }
+    return true;
+}
+
+/**
+ * @brief Defines the globals of a mapped image, in the slots they had when saved.
+ * @param header The header of the image
+ * @param base The start of the mapping
+ * @param strings The strings of the image, by index
+ * @return Whether every global refers to strings of the image and has a valid value.
+ */
+static bool loadGlobals(ImageHeader* header, uint8_t* base, ObjString** strings) {
+    ImageGlobal* globals = (ImageGlobal*)(base + header->globalsOffset);
+    for (uint32_t slot = 0; slot < header->globalCount; slot++) {
+        ImageGlobal* global = &globals[slot];
+        if (global->name >= header->stringCount) {
+            return false;
+        }
+
+        Value value;
+        switch (global->tag) {
+        case IMAGE_UNDEFINED:
+            value = UNDEFINED_VAL;
+            break;
+        case IMAGE_NIL:
+            value = NIL_VAL;
+            break;
+        case IMAGE_FALSE:
+        case IMAGE_TRUE:
+            value = BOOL_VAL(global->tag == IMAGE_TRUE);
+            break;
+        case IMAGE_NUMBER: {
+            double number;
+            memcpy(&number, &global->payload, sizeof(number));
+            value = NUMBER_VAL(number);
+            break;
+        }
+        case IMAGE_STRING:
+            if (global->payload >= header->stringCount) {
+                return false;
+            }
+            value = OBJ_VAL(strings[global->payload]);
+            break;
+        default:
+            return false;
+        }
+
+        // The VM had no globals, so the slots come out the same as when saved, unless a name is repeated.
+        if (globalSlot(strings[global->name]) != (int)slot) {
+            return false;
+        }
+        vm.globalValues.values[slot] = value;
+    }
+    return true;
+}
+
+bool loadImage(const char* path) {
+    if (vm.strings.count != 0 || vm.globalNames.count != 0 || vm.image != NULL) {
+        return imageError(path, "the VM is not fresh");
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(ImageHeader)) {
+        close(fd);
+        return imageError(path, "not an image");
+    }
+
+    // Private and writable: the strings are live objects of the VM now, and their headers may be written to. The file never changes.
+    size_t size = (size_t)status.st_size;
+    uint8_t* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        return false;
+    }
+    ImageMapping* mapping = ALLOCATE(ImageMapping, 1);
+    mapping->base = base;
+    mapping->size = size;
+    // Owned by the VM from here on, even if loading fails part way: the intern table may already point into it.
+    vm.image = mapping;
+
+    ImageHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0) {
+        return imageError(path, "not an image");
+    }
+    if (header.byteOrder != IMAGE_BYTE_ORDER_MARK) {
+        return imageError(path, "saved on a machine with another byte order");
+    }
+    if (header.version != IMAGE_VERSION) {
+        fprintf(stderr, "Could not load image \"%s\": image version %u, expected %d.\n", path, header.version, IMAGE_VERSION);
+        return false;
+    }
+    if (header.stringSize != sizeof(ObjString)) {
+        return imageError(path, "saved by an incompatible build");
+    }
+    if (header.size != size || header.stringsOffset < sizeof(ImageHeader) || header.stringsOffset % 8 != 0 || header.globalsOffset < header.stringsOffset || header.globalsOffset > size ||
+        header.globalsOffset % 8 != 0 || (header.globalsOffset - header.stringsOffset) / sizeof(ObjString) < header.stringCount ||
+        header.globalCount > GLOBALS_MAX || (size - header.globalsOffset) / sizeof(ImageGlobal) < header.globalCount) {
+        return imageError(path, "truncated or corrupted file");
+    }
+
+    ObjString** strings = ALLOCATE(ObjString*, header.stringCount);
+    bool loaded = loadStrings(&header, base, strings) && loadGlobals(&header, base, strings);
+    FREE_ARRAY(ObjString*, strings, header.stringCount);
+    if (!loaded) {
+        return imageError(path, "corrupted strings or globals");
+    }
+    return true;
+}
+
+void unmapImage(ImageMapping* mapping) {
+    if (mapping == NULL) {
+        return;
+    }
+    munmap(mapping->base, mapping->size);
+    FREE(ImageMapping, mapping);
+}
@@ -0,0 +1,791 @@
+#include <shared/Jit.h>
+#include <shared/Debug.h>
+#include <shared/Memory.h>
+#include <shared/Object.h>
+#include <shared/VM.h>
+
+#if defined(JIT) && defined(__x86_64__) && defined(__linux__)
+    #define JIT_X86_64
+#endif
+
+#ifdef JIT_X86_64
+
+#include <sys/mman.h>
+
+// The generated code is a template JIT: each instruction is replaced by a fixed sequence of machine code, with no dispatch in between.
+// The stack top lives in rbx (callee-saved, so it survives calls into C) and is only written back to VM::stackTop around those calls.
+// Numbers are handled inline, behind the same type guards the interpreter uses. Everything else, including runtime errors,
+// calls back into a helper written in C, which takes the stack top, a pointer just past the instruction (for error lines), and an argument,
+// and returns the new stack top, or NULL after reporting a runtime error.
+
+/**
+ * @brief Native code translated from a Chunk.
+ * @var JitCode::code The start of the executable mapping.
+ * @var JitCode::size The size of the mapping.
+ * @var JitCode::entry The offset of the function to call in the mapping. It takes the stack top and returns false on a runtime error.
+ */
+struct JitCode {
+    uint8_t* code;
+    size_t size;
+    size_t entry;
+};
+
+/**
+ * @brief Machine code being generated, before it is copied to executable memory.
+ * @var JitBuffer::count The number of bytes generated
+ * @var JitBuffer::capacity The number of bytes the buffer can hold
+ * @var JitBuffer::code The generated bytes
+ */
+typedef struct {
+    int count;
+    int capacity;
+    uint8_t* code;
+} JitBuffer;
+
+/// @brief Helper called from native code for slow paths.
+typedef Value* (*JitHelper)(Value* top, uint8_t* ip, intptr_t arg);
+
+/// @brief General purpose registers, numbered as in their encoding. Only the first 8 are used, so no REX.B/REX.R bits are ever needed.
+typedef enum {
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI
+} Register;
+
+/// @brief Condition codes of Jcc and SETcc.
+typedef enum {
+    CC_BELOW_EQUAL = 0x6,
+    CC_ABOVE = 0x7,
+    CC_EQUAL = 0x4,
+    CC_NOT_EQUAL = 0x5
+} Condition;
+
+/// @brief Size of a Value on the stack.
+#define VALUE_SIZE ((int32_t)sizeof(Value))
+
+#ifdef NAN_BOXING
+    /// @brief Offset of the double in a number Value.
+    #define NUMBER_OFFSET 0
+#else
+    /// @brief Offset of the double in a number Value.
+    #define NUMBER_OFFSET ((int32_t)offsetof(Value, as))
+#endif
+
+static void emitByte(JitBuffer* buffer, uint8_t byte) {
+    if (buffer->capacity < buffer->count + 1) {
+        int oldCapacity = buffer->capacity;
+        buffer->capacity = GROW_CAPACITY(oldCapacity);
+        buffer->code = GROW_ARRAY(uint8_t, buffer->code, oldCapacity, buffer->capacity);
+    }
+    buffer->code[buffer->count++] = byte;
+}
+
+static void emitBytes(JitBuffer* buffer, int count, const uint8_t* bytes) {
+    for (int i = 0; i < count; i++) {
+        emitByte(buffer, bytes[i]);
+    }
+}
+
+static void emit32(JitBuffer* buffer, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emitByte(buffer, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void emit64(JitBuffer* buffer, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        emitByte(buffer, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+/**
+ * @brief Emits the ModRM byte and displacement of a [base + disp32] memory operand.
+ * @param buffer The buffer to emit into
+ * @param reg The register (or opcode extension) in the reg field
+ * @param base The base register. Not RSP, which would need a SIB byte
+ * @param disp The displacement
+ */
+static void emitMemory(JitBuffer* buffer, int reg, Register base, int32_t disp) {
+    emitByte(buffer, (uint8_t)(0x80 | (reg << 3) | base));
+    emit32(buffer, (uint32_t)disp);
+}
+
+/// @brief mov dst, imm64
+static void emitMoveImmediate(JitBuffer* buffer, Register dst, uint64_t value) {
+    emitByte(buffer, 0x48);
+    emitByte(buffer, (uint8_t)(0xb8 + dst));
+    emit64(buffer, value);
+}
+
+/// @brief mov dst, [base + disp]
+static void emitLoad(JitBuffer* buffer, Register dst, Register base, int32_t disp) {
+    emitBytes(buffer, 2, (uint8_t[]){0x48, 0x8b});
+    emitMemory(buffer, dst, base, disp);
+}
+
+/// @brief mov [base + disp], src
+static void emitStore(JitBuffer* buffer, Register base, int32_t disp, Register src) {
+    emitBytes(buffer, 2, (uint8_t[]){0x48, 0x89});
+    emitMemory(buffer, src, base, disp);
+}
+
+/// @brief 64 bit "op dst, src" for the ALU opcodes of the r/m, reg form (0x89 mov, 0x21 and, 0x09 or, 0x39 cmp, 0x85 test).
+static void emitRegisters(JitBuffer* buffer, uint8_t opcode, Register dst, Register src) {
+    emitBytes(buffer, 3, (uint8_t[]){0x48, opcode, (uint8_t)(0xc0 | (src << 3) | dst)});
+}
+
+/// @brief add rbx, imm32, moving the stack top by a number of Values.
+static void emitMoveTop(JitBuffer* buffer, int values) {
+    emitBytes(buffer, 3, (uint8_t[]){0x48, 0x81, 0xc3});
+    emit32(buffer, (uint32_t)(values * VALUE_SIZE));
+}
+
+/// @brief Copies a Value from [src + srcDisp] to [dst + dstDisp], through rcx.
+static void emitCopyValue(JitBuffer* buffer, Register dst, int32_t dstDisp, Register src, int32_t srcDisp) {
+    for (int32_t offset = 0; offset < VALUE_SIZE; offset += 8) {
+        emitLoad(buffer, RCX, src, srcDisp + offset);
+        emitStore(buffer, dst, dstDisp + offset, RCX);
+    }
+}
+
+/**
+ * @brief Emits a jump whose target is not known yet, to be set with patchJump().
+ * @param buffer The buffer to emit into
+ * @param condition The condition of the jump
+ * @return The offset of the jump's displacement
+ */
+static int emitJump(JitBuffer* buffer, Condition condition) {
+    emitBytes(buffer, 2, (uint8_t[]){0x0f, (uint8_t)(0x80 | condition)});
+    emit32(buffer, 0);
+    return buffer->count - 4;
+}
+
+/// @brief Emits an unconditional jump whose target is not known yet, see emitJump().
+static int emitJumpAlways(JitBuffer* buffer) {
+    emitByte(buffer, 0xe9);
+    emit32(buffer, 0);
+    return buffer->count - 4;
+}
+
+/// @brief Points a jump emitted by emitJump() at the current end of the buffer.
+static void patchJump(JitBuffer* buffer, int displacement) {
+    uint32_t distance = (uint32_t)(buffer->count - (displacement + 4));
+    memcpy(buffer->code + displacement, &distance, sizeof(distance));
+}
+
+/// @brief Emits a conditional jump to an offset already emitted.
+static void emitJumpBack(JitBuffer* buffer, Condition condition, int target) {
+    emitBytes(buffer, 2, (uint8_t[]){0x0f, (uint8_t)(0x80 | condition)});
+    emit32(buffer, (uint32_t)(target - (buffer->count + 4)));
+}
+
+/// @brief SSE2 scalar double instructions, "op xmm, [rbx + disp]" or "op [rbx + disp], xmm".
+static void emitDoubleMemory(JitBuffer* buffer, uint8_t opcode, int xmm, int32_t disp) {
+    emitBytes(buffer, 3, (uint8_t[]){0xf2, 0x0f, opcode});
+    emitMemory(buffer, xmm, RBX, disp);
+}
+
+/// @brief movsd xmm, [base + disp]
+static void emitLoadDouble(JitBuffer* buffer, int xmm, Register base, int32_t disp) {
+    emitBytes(buffer, 3, (uint8_t[]){0xf2, 0x0f, 0x10});
+    emitMemory(buffer, xmm, base, disp);
+}
+
+/**
+ * @brief Emits a jump, to be patched to a slow path, taken if the Value at [rbx + disp] is not a number.
+ * @param buffer The buffer to emit into
+ * @param disp The offset of the Value from the stack top
+ * @return The offset of the jump's displacement
+ */
+static int emitNumberGuard(JitBuffer* buffer, int32_t disp) {
+#ifdef NAN_BOXING
+    emitLoad(buffer, RAX, RBX, disp);
+    emitMoveImmediate(buffer, RDX, QNAN);
+    emitRegisters(buffer, 0x21, RAX, RDX);
+    emitRegisters(buffer, 0x39, RAX, RDX);
+    return emitJump(buffer, CC_EQUAL);
+#else
+    // cmp dword [rbx + disp], VAL_NUMBER
+    emitByte(buffer, 0x81);
+    emitMemory(buffer, 7, RBX, disp + (int32_t)offsetof(Value, type));
+    emit32(buffer, VAL_NUMBER);
+    return emitJump(buffer, CC_NOT_EQUAL);
+#endif
+}
+
+/**
+ * @brief Emits a jump, to be patched to a slow path, taken if the Value at [rax + disp] is the undefined marker.
+ * @param buffer The buffer to emit into
+ * @param disp The offset of the Value from rax
+ * @return The offset of the jump's displacement
+ */
+static int emitUndefinedGuard(JitBuffer* buffer, int32_t disp) {
+#ifdef NAN_BOXING
+    emitLoad(buffer, RCX, RAX, disp);
+    emitMoveImmediate(buffer, RDX, UNDEFINED_VAL);
+    emitRegisters(buffer, 0x39, RCX, RDX);
+#else
+    // cmp dword [rax + disp], VAL_UNDEFINED
+    emitByte(buffer, 0x81);
+    emitMemory(buffer, 7, RAX, disp + (int32_t)offsetof(Value, type));
+    emit32(buffer, VAL_UNDEFINED);
+#endif
+    return emitJump(buffer, CC_EQUAL);
+}
+
+/// @brief Stores al, as a boolean Value, at [rbx + disp].
+static void emitStoreBool(JitBuffer* buffer, int32_t disp) {
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, 0xb6, 0xc0}); // movzx eax, al
+#ifdef NAN_BOXING
+    emitMoveImmediate(buffer, RCX, FALSE_VAL);
+    emitRegisters(buffer, 0x09, RAX, RCX);
+    emitStore(buffer, RBX, disp, RAX);
+#else
+    // mov dword [rbx + disp], VAL_BOOL
+    emitByte(buffer, 0xc7);
+    emitMemory(buffer, 0, RBX, disp + (int32_t)offsetof(Value, type));
+    emit32(buffer, VAL_BOOL);
+    emitStore(buffer, RBX, disp + (int32_t)offsetof(Value, as), RAX);
+#endif
+}
+
+/// @brief Stores a constant Value at [rbx], without moving the stack top.
+static void emitStoreValue(JitBuffer* buffer, Value value) {
+    uint64_t words[sizeof(Value) / 8] = {0};
+#ifdef NAN_BOXING
+    words[0] = value;
+#else
+    // Only the fields are meaningful, not the padding or the rest of the union, so build the words from them.
+    words[0] = (uint64_t)value.type;
+    if (IS_BOOL(value)) {
+        words[1] = AS_BOOL(value);
+    } else {
+        memcpy(&words[1], &value.as, sizeof(value.as));
+    }
+#endif
+    for (int i = 0; i < (int)(sizeof(Value) / 8); i++) {
+        emitMoveImmediate(buffer, RCX, words[i]);
+        emitStore(buffer, RBX, i * 8, RCX);
+    }
+}
+
+/**
+ * @brief Emits a call to a helper. The helper gets the stack top, and its result becomes the new one. A NULL result jumps to the error exit.
+ * @param buffer The buffer to emit into
+ * @param helper The helper to call
+ * @param ip A pointer just past the instruction, in the Chunk's code
+ * @param arg The helper's argument
+ * @param errorExit The offset of the error exit
+ */
+static void emitCall(JitBuffer* buffer, JitHelper helper, uint8_t* ip, intptr_t arg, int errorExit) {
+    emitRegisters(buffer, 0x89, RDI, RBX);
+    emitMoveImmediate(buffer, RSI, (uint64_t)(uintptr_t)ip);
+    emitMoveImmediate(buffer, RDX, (uint64_t)arg);
+    emitMoveImmediate(buffer, RAX, (uint64_t)(uintptr_t)helper);
+    emitBytes(buffer, 2, (uint8_t[]){0xff, 0xd0}); // call rax
+    emitRegisters(buffer, 0x85, RAX, RAX);
+    emitJumpBack(buffer, CC_EQUAL, errorExit);
+    emitRegisters(buffer, 0x89, RBX, RAX);
+}
+
+/// @brief Reports a runtime error for the instruction just before ip.
+static Value* jitError(Value* top, uint8_t* ip, intptr_t message) {
+    vm.stackTop = top;
+    vm.ip = ip;
+    runtimeError("%s", (const char*)message);
+    return NULL;
+}
+
+/// @brief Reports the use of the undefined global variable in slot arg.
+static Value* jitUndefined(Value* top, uint8_t* ip, intptr_t slot) {
+    vm.stackTop = top;
+    vm.ip = ip;
+    runtimeError("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot]));
+    return NULL;
+}
+
+/// @brief OP_ADD on anything but two numbers.
+static Value* jitAdd(Value* top, uint8_t* ip, intptr_t arg) {
+    vm.stackTop = top;
+    if (!IS_ANY_STRING(top[-1]) || !IS_ANY_STRING(top[-2])) {
+        return jitError(top, ip, arg);
+    }
+    gcSafePoint();
+    Obj* b = AS_OBJ(pop());
+    Obj* a = AS_OBJ(pop());
+    push(OBJ_VAL(concatenateLazy(a, b)));
+    return vm.stackTop;
+}
+
+/// @brief OP_EQUAL, or OP_NOT_EQUAL if arg is set, on Values emitEquality() could not compare inline.
+static Value* jitEqual(Value* top, uint8_t* ip, intptr_t arg) {
+    (void)ip;
+    vm.stackTop = top;
+    gcSafePoint();
+    top[-2] = BOOL_VAL(valuesEqual(top[-2], top[-1]) != (bool)arg);
+    return top - 1;
+}
+
+static Value* jitNot(Value* top, uint8_t* ip, intptr_t arg) {
+    (void)ip;
+    (void)arg;
+    vm.stackTop = top;
+    top[-1] = BOOL_VAL(isFalsey(top[-1]));
+    return top;
+}
+
+/// @brief Write barrier of the global variable in slot arg, shading the Value a store is about to overwrite while a major collection is marking.
+static Value* jitGlobalBarrier(Value* top, uint8_t* ip, intptr_t slot) {
+    (void)ip;
+    shadeValue(vm.globalValues.values[slot]);
+    return top;
+}
+
+static Value* jitPrint(Value* top, uint8_t* ip, intptr_t arg) {
+    (void)ip;
+    (void)arg;
+    vm.stackTop = top;
+    gcSafePoint();
+    printValue(top[-1]);
+    printf("\n");
+    return top - 1;
+}
+
+/**
+ * @brief Emits an arithmetic instruction on the two Values on top of the stack, or on the top one and a constant.
+ * @param buffer The buffer to emit into
+ * @param operation The SSE2 opcode of the operation (0x58 add, 0x5c sub, 0x59 mul, 0x5e div)
+ * @param constant The right operand if it is a constant, NULL if it is on the stack
+ * @param slowPath The helper for operands that are not numbers
+ * @param message The error message, passed to the helper
+ * @param ip A pointer just past the instruction
+ * @param errorExit The offset of the error exit
+ */
+static void emitArithmetic(JitBuffer* buffer, uint8_t operation, Value* constant, JitHelper slowPath, const char* message, uint8_t* ip, int errorExit) {
+    int left = constant == NULL ? -2 * VALUE_SIZE : -VALUE_SIZE;
+    int guards[2];
+    int guardCount = 0;
+    guards[guardCount++] = emitNumberGuard(buffer, left);
+    if (constant == NULL) {
+        guards[guardCount++] = emitNumberGuard(buffer, -VALUE_SIZE);
+        emitDoubleMemory(buffer, 0x10, 1, -VALUE_SIZE + NUMBER_OFFSET);
+    } else {
+        emitMoveImmediate(buffer, RAX, (uint64_t)(uintptr_t)constant);
+        emitLoadDouble(buffer, 1, RAX, NUMBER_OFFSET);
+    }
+    emitDoubleMemory(buffer, 0x10, 0, left + NUMBER_OFFSET);
+    emitBytes(buffer, 4, (uint8_t[]){0xf2, 0x0f, operation, 0xc1}); // op xmm0, xmm1
+    emitDoubleMemory(buffer, 0x11, 0, left + NUMBER_OFFSET);
+    if (constant == NULL) {
+        emitMoveTop(buffer, -1);
+    }
+    int done = emitJumpAlways(buffer);
+
+    for (int i = 0; i < guardCount; i++) {
+        patchJump(buffer, guards[i]);
+    }
+    emitCall(buffer, slowPath, ip, (intptr_t)message, errorExit);
+    patchJump(buffer, done);
+}
+
+/**
+ * @brief Emits a comparison of the two numbers on top of the stack.
+ * @param buffer The buffer to emit into
+ * @param swap Whether to compare b to a instead of a to b
+ * @param condition SETcc condition giving the result from ucomisd. CC_ABOVE is false for NaN, CC_BELOW_EQUAL true, matching C's "a > b" and "!(a > b)"
+ * @param ip A pointer just past the instruction
+ * @param errorExit The offset of the error exit
+ */
+static void emitComparison(JitBuffer* buffer, bool swap, Condition condition, uint8_t* ip, int errorExit) {
+    int left = emitNumberGuard(buffer, -2 * VALUE_SIZE);
+    int right = emitNumberGuard(buffer, -VALUE_SIZE);
+    emitDoubleMemory(buffer, 0x10, 0, -2 * VALUE_SIZE + NUMBER_OFFSET);
+    emitDoubleMemory(buffer, 0x10, 1, -VALUE_SIZE + NUMBER_OFFSET);
+    emitBytes(buffer, 4, (uint8_t[]){0x66, 0x0f, 0x2e, swap ? 0xc8 : 0xc1}); // ucomisd
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, (uint8_t)(0x90 | condition), 0xc0});  // setcc al
+    emitStoreBool(buffer, -2 * VALUE_SIZE);
+    emitMoveTop(buffer, -1);
+    int done = emitJumpAlways(buffer);
+
+    patchJump(buffer, left);
+    patchJump(buffer, right);
+    emitCall(buffer, jitError, ip, (intptr_t)"Operands must be numbers.", errorExit);
+    patchJump(buffer, done);
+}
+
+/**
+ * @brief Emits OP_EQUAL or OP_NOT_EQUAL. Everything but two distinct objects is compared inline, those may be ropes and go through valuesEqual().
+ * @param buffer The buffer to emit into
+ * @param negate Whether the instruction is OP_NOT_EQUAL
+ * @param ip A pointer just past the instruction
+ * @param errorExit The offset of the error exit
+ */
+static void emitEquality(JitBuffer* buffer, bool negate, uint8_t* ip, int errorExit) {
+    int32_t a = -2 * VALUE_SIZE;
+    int32_t b = -VALUE_SIZE;
+    int toTrue;
+    int toStore[3];
+    int toSlow[2];
+    int slowCount = 0;
+#ifdef NAN_BOXING
+    emitLoad(buffer, RAX, RBX, a);
+    emitLoad(buffer, RCX, RBX, b);
+    emitRegisters(buffer, 0x39, RAX, RCX);
+    int different = emitJump(buffer, CC_NOT_EQUAL);
+
+    // Same bits: equal, unless they are a NaN number.
+    emitMoveImmediate(buffer, RDX, QNAN);
+    emitRegisters(buffer, 0x89, RSI, RAX);
+    emitRegisters(buffer, 0x21, RSI, RDX);
+    emitRegisters(buffer, 0x39, RSI, RDX);
+    toTrue = emitJump(buffer, CC_EQUAL);
+    emitBytes(buffer, 5, (uint8_t[]){0x66, 0x48, 0x0f, 0x6e, 0xc0}); // movq xmm0, rax
+    emitBytes(buffer, 4, (uint8_t[]){0x66, 0x0f, 0x2e, 0xc0});       // ucomisd xmm0, xmm0
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, 0x9b, 0xc0});             // setnp al
+    toStore[0] = emitJumpAlways(buffer);
+
+    // Different bits: distinct objects may be equal ropes. Otherwise equal only as numbers (0 and -0), any other Value is a NaN to ucomisd.
+    patchJump(buffer, different);
+    emitMoveImmediate(buffer, RDX, QNAN | SIGN_BIT);
+    for (Register operand = RAX; operand <= RCX; operand++) {
+        emitRegisters(buffer, 0x89, RSI, operand);
+        emitRegisters(buffer, 0x21, RSI, RDX);
+        emitRegisters(buffer, 0x39, RSI, RDX);
+        toSlow[slowCount++] = emitJump(buffer, CC_EQUAL);
+    }
+    emitBytes(buffer, 5, (uint8_t[]){0x66, 0x48, 0x0f, 0x6e, 0xc0}); // movq xmm0, rax
+    emitBytes(buffer, 5, (uint8_t[]){0x66, 0x48, 0x0f, 0x6e, 0xc9}); // movq xmm1, rcx
+    emitBytes(buffer, 4, (uint8_t[]){0x66, 0x0f, 0x2e, 0xc1});       // ucomisd xmm0, xmm1
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, 0x94, 0xc0});             // sete al
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, 0x9b, 0xc1});             // setnp cl
+    emitBytes(buffer, 2, (uint8_t[]){0x20, 0xc8});                   // and al, cl
+    toStore[1] = emitJumpAlways(buffer);
+    toStore[2] = -1;
+#else
+    int32_t type = (int32_t)offsetof(Value, type);
+    int32_t as = (int32_t)offsetof(Value, as);
+    emitByte(buffer, 0x8b); // mov eax, a.type
+    emitMemory(buffer, RAX, RBX, a + type);
+    emitByte(buffer, 0x3b); // cmp eax, b.type
+    emitMemory(buffer, RAX, RBX, b + type);
+    int differentTypes = emitJump(buffer, CC_NOT_EQUAL);
+    emitByte(buffer, 0x3d); // cmp eax, VAL_NUMBER
+    emit32(buffer, VAL_NUMBER);
+    int numbers = emitJump(buffer, CC_EQUAL);
+    emitByte(buffer, 0x3d); // cmp eax, VAL_OBJ
+    emit32(buffer, VAL_OBJ);
+    int objects = emitJump(buffer, CC_EQUAL);
+
+    // nil or booleans. nil's payload is 0 too, so comparing the boolean byte works for both.
+    emitBytes(buffer, 2, (uint8_t[]){0x0f, 0xb6}); // movzx eax, byte a.as
+    emitMemory(buffer, RAX, RBX, a + as);
+    emitByte(buffer, 0x3a); // cmp al, byte b.as
+    emitMemory(buffer, RAX, RBX, b + as);
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, 0x94, 0xc0}); // sete al
+    toStore[0] = emitJumpAlways(buffer);
+
+    // Objects: the same one is equal, distinct ones may be equal ropes.
+    patchJump(buffer, objects);
+    emitLoad(buffer, RAX, RBX, a + as);
+    emitBytes(buffer, 2, (uint8_t[]){0x48, 0x3b}); // cmp rax, b.as
+    emitMemory(buffer, RAX, RBX, b + as);
+    toTrue = emitJump(buffer, CC_EQUAL);
+    toSlow[slowCount++] = emitJumpAlways(buffer);
+
+    patchJump(buffer, numbers);
+    emitDoubleMemory(buffer, 0x10, 0, a + as);
+    emitBytes(buffer, 3, (uint8_t[]){0x66, 0x0f, 0x2e}); // ucomisd xmm0, b.as
+    emitMemory(buffer, 0, RBX, b + as);
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, 0x94, 0xc0}); // sete al
+    emitBytes(buffer, 3, (uint8_t[]){0x0f, 0x9b, 0xc1}); // setnp cl
+    emitBytes(buffer, 2, (uint8_t[]){0x20, 0xc8});       // and al, cl
+    toStore[1] = emitJumpAlways(buffer);
+
+    patchJump(buffer, differentTypes);
+    emitBytes(buffer, 2, (uint8_t[]){0x31, 0xc0}); // xor eax, eax
+    toStore[2] = emitJumpAlways(buffer);
+#endif
+
+    patchJump(buffer, toTrue);
+    emitBytes(buffer, 5, (uint8_t[]){0xb8, 0x01, 0x00, 0x00, 0x00}); // mov eax, 1
+    for (int i = 0; i < 3; i++) {
+        if (toStore[i] >= 0) {
+            patchJump(buffer, toStore[i]);
+        }
+    }
+    if (negate) {
+        emitBytes(buffer, 2, (uint8_t[]){0x34, 0x01}); // xor al, 1
+    }
+    emitStoreBool(buffer, a);
+    emitMoveTop(buffer, -1);
+    int done = emitJumpAlways(buffer);
+
+    for (int i = 0; i < slowCount; i++) {
+        patchJump(buffer, toSlow[i]);
+    }
+    emitCall(buffer, jitEqual, ip, negate, errorExit);
+    patchJump(buffer, done);
+}
+
+/**
+ * @brief Reads the 2 byte slot operand of a global instruction and loads the address of the global's Value array into rax.
+ * @param buffer The buffer to emit into
+ * @param operands The operands of the instruction
+ * @return The offset of the global's Value from rax
+ */
+static int32_t emitGlobal(JitBuffer* buffer, uint8_t* operands) {
+    // VM::globalValues grows when later chunks declare new globals, so the array has to be looked up each time.
+    emitMoveImmediate(buffer, RAX, (uint64_t)(uintptr_t)&vm.globalValues.values);
+    emitLoad(buffer, RAX, RAX, 0);
+    return (int32_t)((operands[0] << 8) | operands[1]) * VALUE_SIZE;
+}
+
+/**
+ * @brief Emits the write barrier of a store into a global, before the store: a call to jitGlobalBarrier(), only taken while a major collection is marking.
+ * @param buffer The buffer to emit into
+ * @param operands The operands of the instruction
+ * @param ip A pointer just past the instruction
+ * @param errorExit The offset of the error exit
+ */
+static void emitGlobalBarrier(JitBuffer* buffer, uint8_t* operands, uint8_t* ip, int errorExit) {
+    emitMoveImmediate(buffer, RAX, (uint64_t)(uintptr_t)&vm.heap.phase);
+    emitByte(buffer, 0x83); // cmp dword [rax], GC_MARKING
+    emitMemory(buffer, 7, RAX, 0);
+    emitByte(buffer, GC_MARKING);
+    int idle = emitJump(buffer, CC_NOT_EQUAL);
+    emitCall(buffer, jitGlobalBarrier, ip, (operands[0] << 8) | operands[1], errorExit);
+    patchJump(buffer, idle);
+}
+
+/**
+ * @brief Translates one instruction.
+ * @param buffer The buffer to emit into
+ * @param chunk The Chunk the instruction is in
+ * @param offset The offset of the instruction
+ * @param errorExit The offset of the error exit
+ * @return false if the instruction cannot be translated.
+ */
+static bool translateInstruction(JitBuffer* buffer, Chunk* chunk, int offset, int errorExit) {
+    uint8_t* operands = chunk->code + offset + 1;
+    uint8_t* ip = chunk->code + offset + instructionLength(chunk, offset);
+
+    switch ((OpCode)chunk->code[offset]) {
+    case OP_CONSTANT:
+        emitMoveImmediate(buffer, RAX, (uint64_t)(uintptr_t)&chunk->constants.values[operands[0]]);
+        emitCopyValue(buffer, RBX, 0, RAX, 0);
+        emitMoveTop(buffer, 1);
+        return true;
+    case OP_CONSTANT_LONG: {
+        int index = (operands[0] << 16) | (operands[1] << 8) | operands[2];
+        emitMoveImmediate(buffer, RAX, (uint64_t)(uintptr_t)&chunk->constants.values[index]);
+        emitCopyValue(buffer, RBX, 0, RAX, 0);
+        emitMoveTop(buffer, 1);
+        return true;
+    }
+    case OP_NIL:
+        emitStoreValue(buffer, NIL_VAL);
+        emitMoveTop(buffer, 1);
+        return true;
+    case OP_TRUE:
+        emitStoreValue(buffer, BOOL_VAL(true));
+        emitMoveTop(buffer, 1);
+        return true;
+    case OP_FALSE:
+        emitStoreValue(buffer, BOOL_VAL(false));
+        emitMoveTop(buffer, 1);
+        return true;
+    case OP_EQUAL:
+        emitEquality(buffer, false, ip, errorExit);
+        return true;
+    case OP_NOT_EQUAL:
+        emitEquality(buffer, true, ip, errorExit);
+        return true;
+    case OP_GREATER:
+    case OP_GREATER_NUM:
+        emitComparison(buffer, false, CC_ABOVE, ip, errorExit);
+        return true;
+    case OP_LESS:
+    case OP_LESS_NUM:
+        emitComparison(buffer, true, CC_ABOVE, ip, errorExit);
+        return true;
+    case OP_GREATER_EQUAL:
+    case OP_GREATER_EQUAL_NUM:
+        emitComparison(buffer, true, CC_BELOW_EQUAL, ip, errorExit);
+        return true;
+    case OP_LESS_EQUAL:
+    case OP_LESS_EQUAL_NUM:
+        emitComparison(buffer, false, CC_BELOW_EQUAL, ip, errorExit);
+        return true;
+    case OP_ADD:
+    case OP_ADD_NUM_NUM:
+        emitArithmetic(buffer, 0x58, NULL, jitAdd, "Operands must be two numbers or two strings.", ip, errorExit);
+        return true;
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NUM_NUM:
+        emitArithmetic(buffer, 0x5c, NULL, jitError, "Operands must be numbers.", ip, errorExit);
+        return true;
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NUM_NUM:
+        emitArithmetic(buffer, 0x59, NULL, jitError, "Operands must be numbers.", ip, errorExit);
+        return true;
+    case OP_DIVIDE:
+    case OP_DIVIDE_NUM_NUM:
+        emitArithmetic(buffer, 0x5e, NULL, jitError, "Operands must be numbers.", ip, errorExit);
+        return true;
+    // The optimizer only fuses number constants, and a string plus a number is an error, so OP_ADD_CONSTANT never concatenates.
+    case OP_ADD_CONSTANT:
+        emitArithmetic(buffer, 0x58, &chunk->constants.values[operands[0]], jitError, "Operands must be two numbers or two strings.", ip, errorExit);
+        return true;
+    case OP_SUBTRACT_CONSTANT:
+        emitArithmetic(buffer, 0x5c, &chunk->constants.values[operands[0]], jitError, "Operands must be numbers.", ip, errorExit);
+        return true;
+    case OP_MULTIPLY_CONSTANT:
+        emitArithmetic(buffer, 0x59, &chunk->constants.values[operands[0]], jitError, "Operands must be numbers.", ip, errorExit);
+        return true;
+    case OP_DIVIDE_CONSTANT:
+        emitArithmetic(buffer, 0x5e, &chunk->constants.values[operands[0]], jitError, "Operands must be numbers.", ip, errorExit);
+        return true;
+    case OP_NOT:
+        emitCall(buffer, jitNot, ip, 0, errorExit);
+        return true;
+    case OP_NEGATE:
+    case OP_NEGATE_NUM: {
+        int guard = emitNumberGuard(buffer, -VALUE_SIZE);
+        // btc qword [rbx - VALUE_SIZE + NUMBER_OFFSET], 63: flipping the sign bit is exactly what negating a double does.
+        emitBytes(buffer, 3, (uint8_t[]){0x48, 0x0f, 0xba});
+        emitMemory(buffer, 7, RBX, -VALUE_SIZE + NUMBER_OFFSET);
+        emitByte(buffer, 63);
+        int done = emitJumpAlways(buffer);
+        patchJump(buffer, guard);
+        emitCall(buffer, jitError, ip, (intptr_t)"Operand must be a number.", errorExit);
+        patchJump(buffer, done);
+        return true;
+    }
+    case OP_PRINT:
+        emitCall(buffer, jitPrint, ip, 0, errorExit);
+        return true;
+    case OP_POP:
+        emitMoveTop(buffer, -1);
+        return true;
+    case OP_DEFINE_GLOBAL: {
+        emitGlobalBarrier(buffer, operands, ip, errorExit);
+        int32_t global = emitGlobal(buffer, operands);
+        emitCopyValue(buffer, RAX, global, RBX, -VALUE_SIZE);
+        emitMoveTop(buffer, -1);
+        return true;
+    }
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL: {
+        int32_t global = emitGlobal(buffer, operands);
+        int guard = emitUndefinedGuard(buffer, global);
+        if (chunk->code[offset] == OP_GET_GLOBAL) {
+            emitCopyValue(buffer, RBX, 0, RAX, global);
+            emitMoveTop(buffer, 1);
+        } else {
+            // The barrier clobbers rax.
+            emitGlobalBarrier(buffer, operands, ip, errorExit);
+            emitGlobal(buffer, operands);
+            emitCopyValue(buffer, RAX, global, RBX, -VALUE_SIZE);
+        }
+        int done = emitJumpAlways(buffer);
+        patchJump(buffer, guard);
+        emitCall(buffer, jitUndefined, ip, (operands[0] << 8) | operands[1], errorExit);
+        patchJump(buffer, done);
+        return true;
+    }
+    case OP_RETURN:
+        // Hand the stack top back to the VM and return true.
+        emitMoveImmediate(buffer, RAX, (uint64_t)(uintptr_t)&vm.stackTop);
+        emitStore(buffer, RAX, 0, RBX);
+        emitBytes(buffer, 7, (uint8_t[]){0xb8, 0x01, 0x00, 0x00, 0x00, 0x5b, 0xc3}); // mov eax, 1; pop rbx; ret
+        return true;
+    }
+    return false;
+}
+
+bool jitSupported() {
+    return true;
+}
+
+JitCode* compileJit(Chunk* chunk) {
+    JitBuffer buffer = {0, 0, NULL};
+
+    // The error exit comes first, so every instruction can jump back to it. Helpers have already reported the error and reset the stack.
+    int errorExit = buffer.count;
+    emitBytes(&buffer, 4, (uint8_t[]){0x31, 0xc0, 0x5b, 0xc3}); // xor eax, eax; pop rbx; ret
+
+    // Entry: save rbx, which also aligns the stack to 16 bytes for the calls to helpers, and keep the stack top in it.
+    int entry = buffer.count;
+    emitByte(&buffer, 0x53); // push rbx
+    emitRegisters(&buffer, 0x89, RBX, RDI);
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (!translateInstruction(&buffer, chunk, offset, errorExit)) {
+            FREE_ARRAY(uint8_t, buffer.code, buffer.capacity);
+            return NULL;
+        }
+    }
+
+    // Written and made executable in two steps, so the mapping is never writable and executable at once.
+    size_t size = (size_t)buffer.count;
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        FREE_ARRAY(uint8_t, buffer.code, buffer.capacity);
+        return NULL;
+    }
+    memcpy(code, buffer.code, size);
+    FREE_ARRAY(uint8_t, buffer.code, buffer.capacity);
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return NULL;
+    }
+
+    JitCode* jit = ALLOCATE(JitCode, 1);
+    jit->code = code;
+    jit->size = size;
+    jit->entry = (size_t)entry;
+    return jit;
+}
+
+bool runJit(JitCode* code) {
+    // ISO C has no conversion from a data pointer to a function pointer, copying the bits is the portable way around it.
+    bool (*entry)(Value* stackTop);
+    uint8_t* address = code->code + code->entry;
+    memcpy(&entry, &address, sizeof(entry));
+    return entry(vm.stackTop);
+}
+
+void freeJit(JitCode* code) {
+    if (code == NULL) {
+        return;
+    }
+    munmap(code->code, code->size);
+    FREE(JitCode, code);
+}
+
+#else
+
+bool jitSupported() {
+    return false;
+}
+
+JitCode* compileJit(Chunk* chunk) {
+    (void)chunk;
+    return NULL;
+}
+
+bool runJit(JitCode* code) {
+    (void)code;
+    return false;
+}
+
+void freeJit(JitCode* code) {
+    (void)code;
+}
+
+#endif
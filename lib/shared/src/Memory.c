@@ -1,6 +1,157 @@
+#include <time.h>
+#include <unistd.h>
 #include <shared/Memory.h>
+#include <shared/VM.h>
+
+#ifdef GC_CONCURRENT
+    #include <pthread.h>
+#endif
+
+/// @brief Objects in the nursery start at multiples of this, so their headers are aligned.
+#define NURSERY_ALIGNMENT 8
+
+#ifdef GC_CONCURRENT
+/**
+ * @brief The background thread that marks for the VM. Only Memory.c sees it, so the layout of Heap does not depend on the build.
+ * @details The thread takes batches of objects from Heap::gray and traces them without the lock, so slices only wait for it while it moves objects
+ * between stacks. Besides Heap::gray, it reads the type, mark and fields of old objects. Marks are set atomically, since the program marks too, and
+ * fields it may read while the program writes them are loaded and stored atomically. Nothing it reads is freed while it runs: sweeping waits for marking
+ * to end, which waits for the thread to be idle.
+ * @var Marker::thread The thread
+ * @var Marker::started Whether the thread has been started, which happens with the first major collection
+ * @var Marker::quit Tells the thread to stop
+ * @var Marker::busy Whether the thread is tracing a batch: marking is not over until it is done
+ * @var Marker::lock Guards Heap::gray and the fields above
+ * @var Marker::wake Signaled when there are gray objects to trace, or on quit
+ */
+typedef struct {
+    pthread_t thread;
+    bool started;
+    bool quit;
+    bool busy;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} Marker;
+
+static Marker marker = { .started = false, .quit = false, .busy = false, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+#endif
+
+#ifdef POOL_ALLOCATOR
+    /// @brief Number of size classes of the pools: POOL_GRANULE bytes, twice that, and so on up to POOL_MAX_SIZE.
+    #define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+
+/// @brief A free block of a pool, linked to the next free block of its size class.
+typedef struct PoolBlock {
+    struct PoolBlock* next;
+} PoolBlock;
+
+/**
+ * @brief The size-class pools of reallocate(). Only Memory.c sees them.
+ * @details A freed block goes on the free list of its class, and the next block of that class is taken from there. Only when the list is empty is a
+ * block carved from the current slab: classes share slabs, so a class that is rarely used costs a few blocks rather than a slab of its own. The first
+ * POOL_GRANULE bytes of a slab link it to the previous one. Only the main thread allocates, the marker thread grows its stacks with realloc().
+ * @var Pools::free The free blocks of each class
+ * @var Pools::slabs The slabs, the most recent first
+ * @var Pools::top Where the next block is carved from the current slab
+ * @var Pools::end The end of the current slab
+ * @var Pools::live The number of blocks in use
+ */
+typedef struct {
+    PoolBlock* free[POOL_CLASSES];
+    uint8_t* slabs;
+    uint8_t* top;
+    uint8_t* end;
+    size_t live;
+} Pools;
+
+static Pools pools = { .slabs = NULL, .top = NULL, .end = NULL, .live = 0 };
+
+/**
+ * @brief Gets the size class of a block.
+ * @param size The size of the block, from 1 to POOL_MAX_SIZE
+ * @return The index of its class in Pools::free
+ */
+static size_t poolClass(size_t size) {
+    return (size - 1) / POOL_GRANULE;
+}
+
+/**
+ * @brief Puts a block on the free list of its size class.
+ * @param pointer The block
+ * @param size The size of the block, from 1 to POOL_MAX_SIZE
+ */
+static void poolFree(void* pointer, size_t size) {
+    PoolBlock* block = (PoolBlock*)pointer;
+    size_t sizeClass = poolClass(size);
+    block->next = pools.free[sizeClass];
+    pools.free[sizeClass] = block;
+    pools.live--;
+}
+
+/**
+ * @brief Allocates a block from the pools.
+ * @param size The size of the block, from 1 to POOL_MAX_SIZE
+ * @return The block
+ */
+static void* poolAllocate(size_t size) {
+    size_t sizeClass = poolClass(size);
+    pools.live++;
+    PoolBlock* block = pools.free[sizeClass];
+    if (block != NULL) {
+        pools.free[sizeClass] = block->next;
+        return block;
+    }
+
+    size_t blockSize = (sizeClass + 1) * POOL_GRANULE;
+    if (blockSize > (size_t)(pools.end - pools.top)) {
+        // The end of the current slab is too small for this class, but not for smaller ones.
+        size_t left = (size_t)(pools.end - pools.top);
+        if (left != 0) {
+            PoolBlock* rest = (PoolBlock*)pools.top;
+            rest->next = pools.free[poolClass(left)];
+            pools.free[poolClass(left)] = rest;
+        }
+
+        uint8_t* slab = (uint8_t*)malloc(POOL_SLAB_SIZE);
+        if (slab == NULL) {
+            exit(1);
+        }
+        *(uint8_t**)slab = pools.slabs;
+        pools.slabs = slab;
+        pools.top = slab + POOL_GRANULE;
+        pools.end = slab + POOL_SLAB_SIZE;
+    }
+
+    void* result = pools.top;
+    pools.top += blockSize;
+    return result;
+}
+#endif
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+#ifdef POOL_ALLOCATOR
+    bool wasPooled = pointer != NULL && oldSize <= POOL_MAX_SIZE;
+    bool pooled = newSize != 0 && newSize <= POOL_MAX_SIZE;
+    if (wasPooled && pooled && poolClass(oldSize) == poolClass(newSize)) {
+        return pointer;
+    }
+    if (wasPooled || pooled) {
+        // The block moves between classes, or between a pool and malloc().
+        void* result = pooled ? poolAllocate(newSize) : newSize != 0 ? reallocate(NULL, 0, newSize) : NULL;
+        if (pointer != NULL) {
+            if (result != NULL) {
+                memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+            }
+            if (wasPooled) {
+                poolFree(pointer, oldSize);
+            } else {
+                free(pointer);
+            }
+        }
+        return result;
+    }
+#endif
+
     if (newSize == 0) {
         free(pointer);
         return NULL;
@@ -15,3 +166,720 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 
     return result;
 }
+
+void releasePools() {
+#ifdef POOL_ALLOCATOR
+    if (pools.live != 0) {
+        return;
+    }
+    while (pools.slabs != NULL) {
+        uint8_t* previous = *(uint8_t**)pools.slabs;
+        free(pools.slabs);
+        pools.slabs = previous;
+    }
+    memset(pools.free, 0, sizeof(pools.free));
+    pools.top = NULL;
+    pools.end = NULL;
+#endif
+}
+
+void initHeap(Heap* heap) {
+    heap->nursery = NULL;
+    heap->nurseryTop = NULL;
+    heap->nurseryLimit = NULL;
+    heap->nurseryEnd = NULL;
+    heap->oldBytes = 0;
+    heap->nextMajor = GC_FIRST_MAJOR;
+    heap->collectionPending = false;
+    heap->concurrent = concurrentMarkingSupported() && sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    heap->stress = false;
+    heap->phase = GC_IDLE;
+    heap->pauseNanoseconds = (uint64_t)GC_DEFAULT_PAUSE_US * 1000;
+    heap->allocatedSinceSlice = 0;
+    heap->purgeIndex = 0;
+    heap->purgeEntries = NULL;
+    heap->sweeping = NULL;
+    heap->remembered = NULL;
+    heap->rememberedCount = 0;
+    heap->rememberedCapacity = 0;
+    heap->gray = (GrayStack){ NULL, 0, 0 };
+    heap->shaded = (GrayStack){ NULL, 0, 0 };
+    memset(&heap->stats, 0, sizeof(heap->stats));
+}
+
+/**
+ * @brief Rounds a size up to NURSERY_ALIGNMENT.
+ * @param size The size
+ * @return The rounded size
+ */
+static size_t alignSize(size_t size) {
+    return (size + NURSERY_ALIGNMENT - 1) & ~(size_t)(NURSERY_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Gets the size of an object, as it was allocated.
+ * @param object The object
+ * @return The size of the object
+ */
+static size_t objectSize(Obj* object) {
+    switch (object->type) {
+    case OBJ_STRING:
+        return STRING_SIZE(((ObjString*)object)->length);
+    case OBJ_ROPE:
+        return sizeof(ObjRope);
+    }
+    return 0;
+}
+
+bool isYoung(Obj* object) {
+    return (uint8_t*)object >= vm.heap.nursery && (uint8_t*)object < vm.heap.nurseryEnd;
+}
+
+/**
+ * @brief Allocates an object in the old generation. Its caller links it into VM::objects.
+ * @param size The size of the object
+ * @return The memory for the object
+ */
+static Obj* allocateOld(size_t size) {
+    Heap* heap = &vm.heap;
+    heap->oldBytes += size;
+    if (heap->phase == GC_IDLE && heap->oldBytes > heap->nextMajor) {
+        heap->collectionPending = true;
+    }
+    return (Obj*)reallocate(NULL, 0, size);
+}
+
+/**
+ * @brief Checks whether new objects of the old generation are born marked, as they are between the start of marking and the end of the purge.
+ * @return Whether objects are allocated marked
+ */
+static bool allocatingBlack() {
+    return vm.heap.phase == GC_MARKING || vm.heap.phase == GC_PURGING;
+}
+
+/**
+ * @brief Counts allocated bytes towards the next slice of the major collection in progress, if any.
+ * @param size The number of bytes allocated
+ */
+static void countAllocation(size_t size) {
+    Heap* heap = &vm.heap;
+    heap->allocatedSinceSlice += size;
+    if (heap->phase != GC_IDLE && heap->allocatedSinceSlice > GC_SLICE_QUANTUM) {
+        heap->collectionPending = true;
+    }
+}
+
+Obj* allocateObject(size_t size) {
+    Heap* heap = &vm.heap;
+    if (heap->nursery == NULL) {
+        heap->nursery = (uint8_t*)reallocate(NULL, 0, NURSERY_SIZE);
+        heap->nurseryTop = heap->nursery;
+        heap->nurseryLimit = heap->nursery + NURSERY_SIZE - NURSERY_MAX_OBJECT;
+        heap->nurseryEnd = heap->nursery + NURSERY_SIZE;
+    }
+
+    Obj* object;
+    size_t alignedSize = alignSize(size);
+    if (size <= NURSERY_MAX_OBJECT && alignedSize <= (size_t)(heap->nurseryEnd - heap->nurseryTop)) {
+        object = (Obj*)heap->nurseryTop;
+        heap->nurseryTop += alignedSize;
+        if (heap->nurseryTop > heap->nurseryLimit) {
+            heap->collectionPending = true;
+        }
+    } else {
+        object = allocateOld(size);
+    }
+    countAllocation(size);
+    if (heap->stress) {
+        heap->collectionPending = true;
+    }
+
+    // Old objects allocated while marking are born marked (black), there is no tracing them later.
+    object->isMarked = allocatingBlack() && !isYoung(object);
+    object->next = NULL;
+    return object;
+}
+
+void discardObject(Obj* object, size_t size) {
+    if (!isYoung(object)) {
+        vm.heap.oldBytes -= size;
+        reallocate(object, size, 0);
+    } else if ((uint8_t*)object + alignSize(size) == vm.heap.nurseryTop) {
+        vm.heap.nurseryTop = (uint8_t*)object;
+    }
+}
+
+/**
+ * @brief Gets a monotonic time, to measure pauses.
+ * @return The time in nanoseconds
+ */
+static uint64_t nanoseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+/**
+ * @brief Pushes an object onto a gray stack.
+ * @param stack The stack
+ * @param object The object
+ */
+static void pushGray(GrayStack* stack, Obj* object) {
+    // The collector's own arrays use realloc() directly, they are not objects.
+    if (stack->capacity < stack->count + 1) {
+        stack->capacity = GROW_CAPACITY(stack->capacity);
+        stack->objects = (Obj**)realloc(stack->objects, sizeof(Obj*) * stack->capacity);
+        if (stack->objects == NULL) {
+            exit(1);
+        }
+    }
+    stack->objects[stack->count++] = object;
+}
+
+/**
+ * @brief Marks an object of the old generation as reachable, and queues it for its references to be marked. Safe to call from the marker thread.
+ * @param stack Where to queue the object: the marker thread and the program each have their own
+ * @param object The object, may be NULL
+ */
+static void markObject(GrayStack* stack, Obj* object) {
+    // Young objects are not marked: the nursery is empty when marking starts, so they are all new, and born marked once promoted.
+    if (object == NULL || isYoung(object) || __atomic_exchange_n(&object->isMarked, true, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // Strings refer to nothing, no need to go through the gray stack.
+    if (object->type != OBJ_STRING) {
+        pushGray(stack, object);
+    }
+}
+
+void writeBarrier(Obj* object, Obj* value) {
+    if (value == NULL || !isYoung(value) || isYoung(object)) {
+        return;
+    }
+
+    Heap* heap = &vm.heap;
+    if (heap->rememberedCapacity < heap->rememberedCount + 1) {
+        heap->rememberedCapacity = GROW_CAPACITY(heap->rememberedCapacity);
+        heap->remembered = (Obj**)realloc(heap->remembered, sizeof(Obj*) * heap->rememberedCapacity);
+        if (heap->remembered == NULL) {
+            exit(1);
+        }
+    }
+    heap->remembered[heap->rememberedCount++] = object;
+}
+
+void shadeValue(Value value) {
+    if (IS_OBJ(value)) {
+        markObject(&vm.heap.shaded, AS_OBJ(value));
+    }
+}
+
+bool concurrentMarkingSupported() {
+#ifdef GC_CONCURRENT
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Copies an object of the nursery into the old generation, once. Objects outside the nursery are returned as is.
+ * @param object The object, may be NULL
+ * @return Where the object lives after the minor collection
+ */
+static Obj* promote(Obj* object) {
+    if (object == NULL || !isYoung(object)) {
+        return object;
+    }
+    if (object->next != NULL) {
+        // Already copied, next is the forwarding pointer.
+        return object->next;
+    }
+
+    size_t size = objectSize(object);
+    Obj* copy = allocateOld(size);
+    memcpy(copy, object, size);
+    copy->next = vm.objects;
+    vm.objects = copy;
+    object->next = copy;
+    vm.heap.stats.promotedBytes += size;
+    // Young objects are newer than the snapshot marking traces, their copies are born marked too.
+    copy->isMarked = allocatingBlack();
+    return copy;
+}
+
+/**
+ * @brief Promotes the object a Value refers to, if any, and updates the Value.
+ * @param value The Value
+ */
+static void promoteValue(Value* value) {
+    if (IS_OBJ(*value)) {
+        *value = OBJ_VAL(promote(AS_OBJ(*value)));
+    }
+}
+
+/**
+ * @brief Promotes every object a Value of an array refers to.
+ * @param values The Values
+ * @param count The number of Values
+ */
+static void promoteValues(Value* values, int count) {
+    for (int i = 0; i < count; i++) {
+        promoteValue(&values[i]);
+    }
+}
+
+/**
+ * @brief Promotes the objects an object of the old generation refers to.
+ * @param object The object
+ */
+static void promoteReferences(Obj* object) {
+    if (object->type == OBJ_ROPE) {
+        // The marker thread may be reading these fields, see Marker.
+        ObjRope* rope = (ObjRope*)object;
+        __atomic_store_n(&rope->left, promote(rope->left), __ATOMIC_RELEASE);
+        __atomic_store_n(&rope->right, promote(rope->right), __ATOMIC_RELEASE);
+        __atomic_store_n(&rope->flat, (ObjString*)promote((Obj*)rope->flat), __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Calls a function on every root: the stack, the globals, and the Constant Pool of the running Chunk.
+ * @details The keys of VM::globalSlots are the names in VM::globalNames, so updating those is enough for promotion, but they are roots for marking.
+ * @param visitValues The function to call on each array of Values
+ */
+static void visitRoots(void (*visitValues)(Value* values, int count)) {
+    visitValues(vm.stack, (int)(vm.stackTop - vm.stack));
+    visitValues(vm.globalValues.values, vm.globalValues.count);
+    visitValues(vm.globalNames.values, vm.globalNames.count);
+    if (vm.chunk != NULL) {
+        visitValues(vm.chunk->constants.values, vm.chunk->constants.count);
+    }
+}
+
+/**
+ * @brief Updates the keys of a table after a minor collection. Promoted keys are replaced by their copy, keys that died in the nursery are removed.
+ * @details Entries are placed by the hash the string stores, which its copy keeps, so keys are updated in place.
+ * @param table The table
+ */
+static void updateKeys(Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        ObjString* key = table->entries[i].key;
+        if (key == NULL || !isYoung((Obj*)key)) {
+            continue;
+        }
+        if (key->obj.next != NULL) {
+            table->entries[i].key = (ObjString*)key->obj.next;
+        } else {
+            tableDelete(table, key);
+        }
+    }
+}
+
+/// @brief Empties the nursery, promoting every object still reachable to the old generation.
+static void minorCollection() {
+    Heap* heap = &vm.heap;
+    uint64_t start = nanoseconds();
+    Obj* scanned = vm.objects;
+
+    visitRoots(promoteValues);
+    for (int i = 0; i < heap->rememberedCount; i++) {
+        promoteReferences(heap->remembered[i]);
+    }
+    heap->rememberedCount = 0;
+
+    // Promoted objects are pushed onto VM::objects, and their references promoted in turn, until no new object gets promoted.
+    while (vm.objects != scanned) {
+        Obj* newest = vm.objects;
+        for (Obj* object = newest; object != scanned; object = object->next) {
+            promoteReferences(object);
+        }
+        scanned = newest;
+    }
+
+    // The intern table does not keep strings alive. The global names are roots, so their keys are always promoted.
+    updateKeys(&vm.strings);
+    updateKeys(&vm.globalSlots);
+
+    heap->stats.nurseryBytes += (uint64_t)(heap->nurseryTop - heap->nursery);
+    heap->nurseryTop = heap->nursery;
+
+    uint64_t pause = nanoseconds() - start;
+    heap->stats.minorCollections++;
+    heap->stats.minorNanoseconds += pause;
+    if (pause > heap->stats.minorMaxNanoseconds) {
+        heap->stats.minorMaxNanoseconds = pause;
+    }
+}
+
+/**
+ * @brief Shades every object an array of Values refers to.
+ * @param values The Values
+ * @param count The number of Values
+ */
+static void shadeValues(Value* values, int count) {
+    for (int i = 0; i < count; i++) {
+        shadeValue(values[i]);
+    }
+}
+
+/**
+ * @brief Frees an object of the old generation, along with any memory it owns.
+ * @param object The object to free
+ */
+static void freeObject(Obj* object) {
+    size_t size = objectSize(object);
+    vm.heap.oldBytes -= size;
+    // The halves and the flattened string of a rope are objects of their own.
+    reallocate(object, size, 0);
+}
+
+/**
+ * @brief Marks the objects a gray object refers to, making it black. Safe to call from the marker thread.
+ * @param stack Where to queue the objects marked
+ * @param object The object
+ */
+static void blackenObject(GrayStack* stack, Obj* object) {
+    if (object->type == OBJ_ROPE) {
+        ObjRope* rope = (ObjRope*)object;
+        markObject(stack, __atomic_load_n(&rope->left, __ATOMIC_ACQUIRE));
+        markObject(stack, __atomic_load_n(&rope->right, __ATOMIC_ACQUIRE));
+        markObject(stack, (Obj*)__atomic_load_n(&rope->flat, __ATOMIC_ACQUIRE));
+    }
+}
+
+/**
+ * @brief Gets the number of gray objects to trace between two looks at the clock, or at the deadline.
+ * @return GC_WORK_CHUNK, or 1 under Heap::stress, so that the program runs between as many steps of marking as possible
+ */
+static int markChunk() {
+    return vm.heap.stress ? 1 : GC_WORK_CHUNK;
+}
+
+/**
+ * @brief Checks whether a slice of the major collection should stop.
+ * @param deadline When the slice should end, 0 for never
+ * @return Whether the deadline has passed
+ */
+static bool pastDeadline(uint64_t deadline) {
+    return deadline != 0 && nanoseconds() >= deadline;
+}
+
+#ifdef GC_CONCURRENT
+/**
+ * @brief Body of the marker thread: traces batches of Heap::gray until told to quit.
+ * @param unused Unused
+ * @return NULL
+ */
+static void* runMarker(void* unused) {
+    (void)unused;
+    Heap* heap = &vm.heap;
+    GrayStack marked = { NULL, 0, 0 };
+    Obj* batch[GC_WORK_CHUNK];
+
+    pthread_mutex_lock(&marker.lock);
+    for (;;) {
+        while (!marker.quit && heap->gray.count == 0) {
+            pthread_cond_wait(&marker.wake, &marker.lock);
+        }
+        if (marker.quit) {
+            break;
+        }
+
+        int count = 0;
+        while (count < markChunk() && heap->gray.count > 0) {
+            batch[count++] = heap->gray.objects[--heap->gray.count];
+        }
+        marker.busy = true;
+        pthread_mutex_unlock(&marker.lock);
+
+        for (int i = 0; i < count; i++) {
+            blackenObject(&marked, batch[i]);
+        }
+
+        pthread_mutex_lock(&marker.lock);
+        for (int i = 0; i < marked.count; i++) {
+            pushGray(&heap->gray, marked.objects[i]);
+        }
+        marked.count = 0;
+        marker.busy = false;
+    }
+    pthread_mutex_unlock(&marker.lock);
+
+    free(marked.objects);
+    return NULL;
+}
+
+/// @brief Stops the marker thread, if it was started.
+static void stopMarker() {
+    if (!marker.started) {
+        return;
+    }
+    pthread_mutex_lock(&marker.lock);
+    marker.quit = true;
+    pthread_cond_signal(&marker.wake);
+    pthread_mutex_unlock(&marker.lock);
+    pthread_join(marker.thread, NULL);
+    marker.started = false;
+    marker.quit = false;
+}
+#endif
+
+/**
+ * @brief Starts a major collection: empties the nursery and shades the roots, see Heap for why that is enough.
+ */
+static void startMajor() {
+    Heap* heap = &vm.heap;
+    if (heap->nurseryTop != heap->nursery) {
+        minorCollection();
+    }
+    heap->phase = GC_MARKING;
+    visitRoots(shadeValues);
+
+#ifdef GC_CONCURRENT
+    if (heap->concurrent && !marker.started) {
+        marker.started = pthread_create(&marker.thread, NULL, runMarker, NULL) == 0;
+    }
+#endif
+}
+
+/**
+ * @brief Carries on marking: hands the objects the program shaded over to Heap::gray, then traces gray objects until there are none left or the deadline
+ * passes. With a marker thread, the slice leaves the tracing to it, unless the program allocates faster than it marks.
+ * Marking is over once no gray object is left and the marker thread is idle. Since nothing is scanned again, that is the final remark.
+ * @param deadline When to stop, 0 for never
+ * @param assist Whether to trace here even though the marker thread is running
+ * @return Whether marking is over, and the purge of the intern table has started.
+ */
+static bool markSlice(uint64_t deadline, bool assist) {
+    Heap* heap = &vm.heap;
+    bool threaded = false;
+#ifdef GC_CONCURRENT
+    threaded = marker.started;
+    pthread_mutex_lock(&marker.lock);
+#endif
+    for (int i = 0; i < heap->shaded.count; i++) {
+        pushGray(&heap->gray, heap->shaded.objects[i]);
+    }
+    heap->shaded.count = 0;
+
+    bool done = false;
+    for (;;) {
+        if (!threaded || assist) {
+            for (int work = 0; work < markChunk() && heap->gray.count > 0; work++) {
+                blackenObject(&heap->gray, heap->gray.objects[--heap->gray.count]);
+            }
+        }
+        if (heap->gray.count == 0) {
+#ifdef GC_CONCURRENT
+            // The marker thread may still push the references of its batch.
+            done = !marker.busy;
+#else
+            done = true;
+#endif
+            break;
+        }
+        if ((threaded && !assist) || pastDeadline(deadline)) {
+            break;
+        }
+    }
+
+#ifdef GC_CONCURRENT
+    if (!done && threaded) {
+        pthread_cond_signal(&marker.wake);
+    }
+    pthread_mutex_unlock(&marker.lock);
+#endif
+
+    if (done) {
+        heap->phase = GC_PURGING;
+        heap->purgeIndex = 0;
+        heap->purgeEntries = vm.strings.entries;
+    }
+    return done;
+}
+
+/**
+ * @brief Removes unmarked strings from the intern table, since it does not keep them alive, until none are left or the deadline passes.
+ * Then moves the old generation to Heap::sweeping.
+ * @param deadline When to stop, 0 for never
+ * @return Whether the purge is over.
+ */
+static bool purgeSlice(uint64_t deadline) {
+    Heap* heap = &vm.heap;
+    for (;;) {
+        // Growing or rehashing the table between slices moves its entries around. The purge starts over, the strings left are all marked or young.
+        if (heap->purgeEntries != vm.strings.entries) {
+            heap->purgeEntries = vm.strings.entries;
+            heap->purgeIndex = 0;
+        }
+        for (int work = 0; work < GC_WORK_CHUNK && heap->purgeIndex < vm.strings.capacity; work++) {
+            ObjString* key = vm.strings.entries[heap->purgeIndex++].key;
+            if (key != NULL && !key->obj.isMarked && !isYoung((Obj*)key)) {
+                tableDelete(&vm.strings, key);
+            }
+        }
+        if (heap->purgeIndex >= vm.strings.capacity) {
+            break;
+        }
+        if (pastDeadline(deadline)) {
+            return false;
+        }
+    }
+
+    // Objects allocated from here on are not part of this collection, they go to a fresh list.
+    heap->sweeping = vm.objects;
+    vm.objects = NULL;
+    heap->phase = GC_SWEEPING;
+    return true;
+}
+
+/**
+ * @brief Frees unmarked objects of Heap::sweeping, and moves marked ones back to the old generation, until none are left or the deadline passes.
+ * @param deadline When to stop, 0 for never
+ * @return Whether sweeping is over.
+ */
+static bool sweepSlice(uint64_t deadline) {
+    Heap* heap = &vm.heap;
+    for (;;) {
+        for (int work = 0; work < GC_WORK_CHUNK && heap->sweeping != NULL; work++) {
+            Obj* object = heap->sweeping;
+            heap->sweeping = object->next;
+            if (object->isMarked) {
+                object->isMarked = false;
+                object->next = vm.objects;
+                vm.objects = object;
+            } else {
+                freeObject(object);
+            }
+        }
+        if (heap->sweeping == NULL) {
+            return true;
+        }
+        if (pastDeadline(deadline)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Runs the major collection for one slice: starts it if the old generation has grown enough, and carries it on until the deadline.
+ * @param deadline When the slice should end, 0 to run the whole collection
+ */
+static void majorSlice(uint64_t deadline) {
+    Heap* heap = &vm.heap;
+    uint64_t start = nanoseconds();
+    if (heap->phase == GC_IDLE) {
+        if (heap->oldBytes <= heap->nextMajor && !heap->stress) {
+            return;
+        }
+        startMajor();
+    }
+
+    GcPhase first = heap->phase;
+    if (heap->phase == GC_MARKING) {
+        // A program that outgrows the old generation's limit during the collection has to help the marker thread.
+        markSlice(deadline, deadline == 0 || heap->oldBytes > heap->nextMajor * GC_HEAP_GROW_FACTOR);
+    }
+    // The next phase starts in the same slice if the previous one left time for it.
+    if (heap->phase == GC_PURGING && (first == GC_PURGING || !pastDeadline(deadline))) {
+        purgeSlice(deadline);
+    }
+    if (heap->phase == GC_SWEEPING && (first == GC_SWEEPING || !pastDeadline(deadline)) && sweepSlice(deadline)) {
+        heap->phase = GC_IDLE;
+        heap->stats.majorCollections++;
+        heap->nextMajor = heap->oldBytes * GC_HEAP_GROW_FACTOR;
+        if (heap->nextMajor < GC_FIRST_MAJOR) {
+            heap->nextMajor = GC_FIRST_MAJOR;
+        }
+    }
+
+    uint64_t time = nanoseconds() - start;
+    heap->stats.majorSlices++;
+    heap->stats.majorNanoseconds += time;
+    if (time > heap->stats.majorMaxNanoseconds) {
+        heap->stats.majorMaxNanoseconds = time;
+    }
+}
+
+/**
+ * @brief Records a pause in the statistics.
+ * @param pause The length of the pause, in nanoseconds
+ */
+static void recordPause(uint64_t pause) {
+    GcStats* stats = &vm.heap.stats;
+    stats->pauses++;
+    if (pause > stats->maxPauseNanoseconds) {
+        stats->maxPauseNanoseconds = pause;
+    }
+
+    int bucket = 0;
+    for (uint64_t micros = pause / 1000; micros > 0 && bucket < GC_PAUSE_BUCKETS - 1; micros >>= 1) {
+        bucket++;
+    }
+    stats->pauseHistogram[bucket]++;
+}
+
+uint64_t pausePercentile(const GcStats* stats, double percentile) {
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < GC_PAUSE_BUCKETS - 1; bucket++) {
+        seen += stats->pauseHistogram[bucket];
+        if (seen > 0 && 100.0 * (double)seen >= percentile * (double)stats->pauses) {
+            return (uint64_t)1 << bucket;
+        }
+    }
+    return (stats->maxPauseNanoseconds + 999) / 1000;
+}
+
+void collectGarbage() {
+    Heap* heap = &vm.heap;
+    heap->collectionPending = false;
+    heap->allocatedSinceSlice = 0;
+    if (heap->nursery == NULL) {
+        return;
+    }
+
+    uint64_t start = nanoseconds();
+    if (heap->nurseryTop > heap->nurseryLimit || (heap->stress && heap->nurseryTop != heap->nursery)) {
+        minorCollection();
+    }
+
+    // Under stress, a slice is one step of work: its deadline has always passed.
+    uint64_t deadline = heap->stress ? 1 : heap->pauseNanoseconds == 0 ? 0 : start + heap->pauseNanoseconds;
+    majorSlice(deadline);
+    // If the program promotes faster than slices collect, the old generation would grow without bounds. Slices then run at every safe point until the
+    // collection ends, rather than every GC_SLICE_QUANTUM bytes: pauses stay within the target, the program is slowed down instead.
+    heap->collectionPending = heap->phase != GC_IDLE && (heap->oldBytes > heap->nextMajor * GC_HEAP_GROW_FACTOR || heap->stress);
+
+    recordPause(nanoseconds() - start);
+}
+
+/**
+ * @brief Frees every object of a list.
+ * @param object The first object of the list
+ */
+static void freeList(Obj* object) {
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+}
+
+void freeObjects() {
+#ifdef GC_CONCURRENT
+    // The marker thread reads objects, it has to be gone before they are.
+    stopMarker();
+#endif
+    freeList(vm.objects);
+    vm.objects = NULL;
+
+    Heap* heap = &vm.heap;
+    freeList(heap->sweeping);
+    FREE_ARRAY(uint8_t, heap->nursery, NURSERY_SIZE);
+    free(heap->remembered);
+    free(heap->gray.objects);
+    free(heap->shaded.objects);
+    initHeap(heap);
+}
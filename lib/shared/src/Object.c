@@ -1,5 +1,249 @@
+#include <shared/Memory.h>
 #include <shared/Object.h>
+#include <shared/Table.h>
+#include <shared/VM.h>
 
-void a() {
-    printf("");
+/// @brief The FNV-1a offset basis, the hash of the empty string.
+#define HASH_START 2166136261u
+
+/**
+ * @brief Sets the type of a freshly allocated object, and links it into the VM's list of objects if it was allocated in the old generation.
+ * @param object The object to initialize
+ * @param type The type of the object
+ */
+static void initObject(Obj* object, ObjType type) {
+    object->type = type;
+
+    if (!isYoung(object)) {
+        object->next = vm.objects;
+        vm.objects = object;
+    }
+}
+
+/**
+ * @brief Hashes a string with FNV-1a.
+ * @param hash The hash to continue from, HASH_START to start a new one. FNV-1a has no finalization step, so the hash of a string can be extended with more characters
+ * @param key The characters to hash
+ * @param length The number of characters
+ * @return The hash of the string
+ */
+static uint32_t hashString(uint32_t hash, const char* key, int length) {
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/**
+ * @brief Looks up a string in the intern table, keeping count of the lookups and hits.
+ * @param chars The characters of the string
+ * @param length The number of characters
+ * @param hash The hash of the string
+ * @return The interned string, or NULL if there is none yet
+ */
+static ObjString* findInterned(const char* chars, int length, uint32_t hash) {
+    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    vm.internLookups++;
+    if (interned != NULL) {
+        vm.internHits++;
+        // The intern table does not keep strings alive: during a major collection, a string found here may be unmarked, and has to survive now.
+        if (vm.heap.phase == GC_MARKING || vm.heap.phase == GC_PURGING) {
+            shadeValue(OBJ_VAL(interned));
+        }
+    }
+    return interned;
+}
+
+/**
+ * @brief Allocates a string object, with room for its characters right after the header. The characters are left for the caller to fill.
+ * @details The string is not interned nor linked into the VM's objects yet, so it can still be thrown away with discardString().
+ * @param length The number of characters
+ * @return The new string, already null-terminated
+ */
+static ObjString* allocateString(int length) {
+    ObjString* string = (ObjString*)allocateObject(STRING_SIZE(length));
+    string->length = length;
+    string->chars[length] = '\0';
+    return string;
+}
+
+/**
+ * @brief Frees a string made by allocateString() that was never interned.
+ * @param string The string to free
+ */
+static void discardString(ObjString* string) {
+    discardObject((Obj*)string, STRING_SIZE(string->length));
+}
+
+/**
+ * @brief Makes a string made by allocateString() a live object, and adds it to the intern table.
+ * @param string The string, with its characters and hash filled in
+ * @return The string
+ */
+static ObjString* internString(ObjString* string) {
+    initObject((Obj*)string, OBJ_STRING);
+    // Only the key matters, the table is used as a set.
+    tableSet(&vm.strings, string, NIL_VAL);
+    return string;
+}
+
+ObjString* copyString(const char* chars, int length) {
+    uint32_t hash = hashString(HASH_START, chars, length);
+    ObjString* interned = findInterned(chars, length, hash);
+    if (interned != NULL) {
+        return interned;
+    }
+
+    ObjString* string = allocateString(length);
+    memcpy(string->chars, chars, length);
+    string->hash = hash;
+    return internString(string);
+}
+
+ObjString* concatenateStrings(ObjString* a, ObjString* b) {
+    int length = a->length + b->length;
+    ObjString* string = allocateString(length);
+    memcpy(string->chars, a->chars, a->length);
+    memcpy(string->chars + a->length, b->chars, b->length);
+    // No need to go over the left string's characters again.
+    string->hash = hashString(a->hash, b->chars, b->length);
+
+    ObjString* interned = findInterned(string->chars, length, string->hash);
+    if (interned != NULL) {
+        discardString(string);
+        return interned;
+    }
+    return internString(string);
+}
+
+/**
+ * @brief Gets the length of a string object, flat or rope.
+ * @param string The string
+ * @return The number of characters
+ */
+static int stringLength(Obj* string) {
+    return string->type == OBJ_STRING ? ((ObjString*)string)->length : ((ObjRope*)string)->length;
+}
+
+/**
+ * @brief Replaces an already flattened rope with its flat string, so new ropes don't keep the old tree reachable.
+ * @param string The string, flat or rope
+ * @return The flat string if there is one, otherwise the given string
+ */
+static Obj* resolveString(Obj* string) {
+    if (string->type == OBJ_ROPE && ((ObjRope*)string)->flat != NULL) {
+        return (Obj*)((ObjRope*)string)->flat;
+    }
+    return string;
+}
+
+Obj* concatenateLazy(Obj* a, Obj* b) {
+    a = resolveString(a);
+    b = resolveString(b);
+
+    int lengthA = stringLength(a);
+    int lengthB = stringLength(b);
+    if (lengthA == 0) {
+        return b;
+    }
+    if (lengthB == 0) {
+        return a;
+    }
+
+    if (lengthA + lengthB < ROPE_MIN_LENGTH) {
+        // Ropes are never shorter than ROPE_MIN_LENGTH, so both halves are flat.
+        return (Obj*)concatenateStrings((ObjString*)a, (ObjString*)b);
+    }
+
+    ObjRope* rope = (ObjRope*)allocateObject(sizeof(ObjRope));
+    initObject((Obj*)rope, OBJ_ROPE);
+    rope->length = lengthA + lengthB;
+    rope->left = a;
+    rope->right = b;
+    rope->flat = NULL;
+    // Only needed when the nursery was full and the rope went straight to the old generation.
+    writeBarrier((Obj*)rope, a);
+    writeBarrier((Obj*)rope, b);
+    return (Obj*)rope;
+}
+
+ObjString* flattenRope(ObjRope* rope) {
+    if (rope->flat != NULL) {
+        return rope->flat;
+    }
+
+    ObjString* string = allocateString(rope->length);
+
+    // Copy the leaves from right to left, so a left-leaning tree (s = s + x) only ever has one node pending.
+    // Ropes can be very deep, so the pending nodes are kept on an explicit stack rather than recursing.
+    int pendingCount = 0;
+    int pendingCapacity = 0;
+    Obj** pending = NULL;
+    int end = rope->length;
+    Obj* node = (Obj*)rope;
+    for (;;) {
+        node = resolveString(node);
+        if (node->type == OBJ_ROPE) {
+            if (pendingCapacity < pendingCount + 1) {
+                int oldCapacity = pendingCapacity;
+                pendingCapacity = GROW_CAPACITY(oldCapacity);
+                pending = GROW_ARRAY(Obj*, pending, oldCapacity, pendingCapacity);
+            }
+            pending[pendingCount++] = ((ObjRope*)node)->left;
+            node = ((ObjRope*)node)->right;
+            continue;
+        }
+
+        ObjString* leaf = (ObjString*)node;
+        end -= leaf->length;
+        memcpy(string->chars + end, leaf->chars, leaf->length);
+
+        if (pendingCount == 0) {
+            break;
+        }
+        node = pending[--pendingCount];
+    }
+    FREE_ARRAY(Obj*, pending, pendingCapacity);
+
+    string->hash = hashString(HASH_START, string->chars, string->length);
+    ObjString* interned = findInterned(string->chars, string->length, string->hash);
+    if (interned != NULL) {
+        discardString(string);
+        string = interned;
+    } else {
+        internString(string);
+    }
+
+    // The marker thread may be reading the fields. Dropping the halves loses nothing it needs: only the flat string is read from now on.
+    __atomic_store_n(&rope->flat, string, __ATOMIC_RELEASE);
+    writeBarrier((Obj*)rope, (Obj*)string);
+    __atomic_store_n(&rope->left, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&rope->right, NULL, __ATOMIC_RELEASE);
+    return string;
+}
+
+bool stringsEqual(Value a, Value b) {
+    if (!IS_ANY_STRING(a) || !IS_ANY_STRING(b)) {
+        return false;
+    }
+    if (stringLength(AS_OBJ(a)) != stringLength(AS_OBJ(b))) {
+        return false;
+    }
+
+    ObjString* x = IS_ROPE(a) ? flattenRope((ObjRope*)AS_OBJ(a)) : AS_STRING(a);
+    ObjString* y = IS_ROPE(b) ? flattenRope((ObjRope*)AS_OBJ(b)) : AS_STRING(b);
+    // Both are interned now.
+    return x == y;
+}
+
+void printObject(Value value) {
+    switch (OBJ_TYPE(value)) {
+    case OBJ_STRING:
+        printf("%s", AS_CSTRING(value));
+        break;
+    case OBJ_ROPE:
+        printf("%s", flattenRope((ObjRope*)AS_OBJ(value))->chars);
+        break;
+    }
 }
@@ -0,0 +1,83 @@
+#include <shared/Optimizer.h>
+
+/**
+ * @brief Finds the superinstruction replacing a pair of instructions.
+ * @param chunk The chunk containing the instructions
+ * @param offset The offset of the first instruction
+ * @param next The offset of the second instruction
+ * @return The fused opcode, or -1 if the pair can't be fused
+ */
+static int fusedOpcode(Chunk* chunk, int offset, int next) {
+    uint8_t first = chunk->code[offset];
+    uint8_t second = chunk->code[next];
+
+    if (second == OP_NOT) {
+        switch (first) {
+        case OP_EQUAL:
+            return OP_NOT_EQUAL;
+        case OP_LESS:
+            return OP_GREATER_EQUAL;
+        case OP_GREATER:
+            return OP_LESS_EQUAL;
+        default:
+            return -1;
+        }
+    }
+
+    // Only numbers, so the fused instructions never have to check the type of the constant.
+    if (first != OP_CONSTANT || !IS_NUMBER(chunk->constants.values[chunk->code[offset + 1]])) {
+        return -1;
+    }
+
+    switch (second) {
+    case OP_ADD:
+        return OP_ADD_CONSTANT;
+    case OP_SUBTRACT:
+        return OP_SUBTRACT_CONSTANT;
+    case OP_MULTIPLY:
+        return OP_MULTIPLY_CONSTANT;
+    case OP_DIVIDE:
+        return OP_DIVIDE_CONSTANT;
+    default:
+        return -1;
+    }
+}
+
+void optimizeChunk(Chunk* chunk) {
+    // The compiler doesn't emit any jumps yet, so instructions can be merged without fixing up any offsets.
+    Chunk optimized;
+    initChunk(&optimized);
+
+    for (int offset = 0; offset < chunk->count;) {
+        int length = instructionLength(chunk, offset);
+        int next = offset + length;
+
+        if (next < chunk->count) {
+            int fused = fusedOpcode(chunk, offset, next);
+            if (fused != -1) {
+                // The second instruction is the one that can raise a runtime error, so the fused instruction takes its line.
+                int line = getLine(chunk, next);
+                writeChunk(&optimized, (uint8_t)fused, line);
+                for (int i = 1; i < length; i++) {
+                    writeChunk(&optimized, chunk->code[offset + i], line);
+                }
+                offset = next + instructionLength(chunk, next);
+                continue;
+            }
+        }
+
+        for (int i = 0; i < length; i++) {
+            writeChunk(&optimized, chunk->code[offset + i], getLine(chunk, offset + i));
+        }
+        offset = next;
+    }
+
+    // The constants are left untouched, hand them (and their index) over to the optimized chunk before freeing the old code.
+    optimized.constants = chunk->constants;
+    optimized.constantIndex = chunk->constantIndex;
+    initValueArray(&chunk->constants);
+    chunk->constantIndex.capacity = 0;
+    chunk->constantIndex.slots = NULL;
+    freeChunk(chunk);
+    *chunk = optimized;
+}
@@ -0,0 +1,334 @@
+#include <shared/Memory.h>
+#include <shared/Object.h>
+#include <shared/Table.h>
+
+#if defined(__SSE2__) && !defined(TABLE_SCALAR)
+    #define TABLE_SSE2
+    #include <emmintrin.h>
+#endif
+
+/// @brief Maximum fraction of the slots that can be in use (tombstones included) before the table grows.
+#define TABLE_MAX_LOAD 0.875
+
+/// @brief Control byte of a slot that was never used. Has the high bit set, like CONTROL_DELETED, while the control bytes of used slots never do.
+#define CONTROL_EMPTY 0x80
+/// @brief Control byte of a slot whose entry was deleted.
+#define CONTROL_DELETED 0xfe
+
+/**
+ * @brief Bit mask with one bit per slot of a group.
+ * @details Bit i is set if slot i of the group matches.
+ */
+typedef uint32_t GroupMask;
+
+/**
+ * @brief Gets the 7 bits of a hash stored in the control byte.
+ * @param hash The hash of a key
+ * @return The control byte of a slot holding the key
+ */
+static inline uint8_t hashTag(uint32_t hash) {
+    return hash & 0x7f;
+}
+
+/**
+ * @brief Gets the group a hash starts probing from. Uses the bits not in the tag.
+ * @param hash The hash of a key
+ * @param capacity The capacity of the table
+ * @return The index of the first slot of the group
+ */
+static inline int firstGroup(uint32_t hash, int capacity) {
+    return (int)(((hash >> 7) * TABLE_GROUP_WIDTH) & (uint32_t)(capacity - 1));
+}
+
+#ifdef TABLE_SSE2
+
+/**
+ * @brief Finds the slots of a group with the given control byte.
+ * @param control The control bytes of the group
+ * @param byte The control byte to look for
+ * @return A mask of the matching slots
+ */
+static inline GroupMask matchByte(const uint8_t* control, uint8_t byte) {
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+}
+
+/**
+ * @brief Finds the slots of a group that are not in use, empty or deleted.
+ * @param control The control bytes of the group
+ * @return A mask of the free slots
+ */
+static inline GroupMask matchFree(const uint8_t* control) {
+    // Only free slots have the high bit set, which is exactly what movemask extracts.
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)control));
+}
+
+#else
+
+/// @brief A byte of 0x01 in every lane of a 64 bit word.
+#define SWAR_LOW_BITS 0x0101010101010101ULL
+/// @brief A byte of 0x80 in every lane of a 64 bit word.
+#define SWAR_HIGH_BITS 0x8080808080808080ULL
+
+/**
+ * @brief Packs the high bit of each byte of a word into an 8 bit mask, with byte i (in memory order) as bit i.
+ * @param word A word with bits set only at the high bit of its bytes
+ * @return The packed mask
+ */
+static inline GroupMask packHighBits(uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    // The multiplication shifts every high bit into the top byte, each at its own position, without any carries.
+    return (GroupMask)(((word >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+/**
+ * @brief Loads 8 control bytes as a word.
+ * @param control The control bytes
+ * @return The word
+ */
+static inline uint64_t loadWord(const uint8_t* control) {
+    uint64_t word;
+    memcpy(&word, control, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief Finds the zero bytes of a word, 8 bytes at a time within a single register. Exact, borrows can't cross into the next byte.
+ * @param word The word to look in
+ * @return A word with the high bit set in every byte that was zero
+ */
+static inline uint64_t zeroBytes(uint64_t word) {
+    return ~(((word & ~SWAR_HIGH_BITS) + ~SWAR_HIGH_BITS) | word) & SWAR_HIGH_BITS;
+}
+
+static inline GroupMask matchByte(const uint8_t* control, uint8_t byte) {
+    uint64_t pattern = SWAR_LOW_BITS * byte;
+    GroupMask low = packHighBits(zeroBytes(loadWord(control) ^ pattern));
+    GroupMask high = packHighBits(zeroBytes(loadWord(control + 8) ^ pattern));
+    return low | high << 8;
+}
+
+static inline GroupMask matchFree(const uint8_t* control) {
+    GroupMask low = packHighBits(loadWord(control) & SWAR_HIGH_BITS);
+    GroupMask high = packHighBits(loadWord(control + 8) & SWAR_HIGH_BITS);
+    return low | high << 8;
+}
+
+#endif
+
+/**
+ * @brief Gets the first slot of a mask, and removes it from the mask.
+ * @param mask The mask, not 0
+ * @return The index of the slot within its group
+ */
+static inline int nextMatch(GroupMask* mask) {
+    int index = __builtin_ctz(*mask);
+    *mask &= *mask - 1;
+    return index;
+}
+
+/**
+ * @brief Moves on to the next group of a probe sequence.
+ * @details Skips one more group each time (triangular numbers), which visits every group once when the number of groups is a power of 2.
+ * @param group The index of the first slot of the current group
+ * @param probe The number of groups probed so far
+ * @param capacity The capacity of the table
+ * @return The index of the first slot of the next group
+ */
+static inline int nextGroup(int group, int probe, int capacity) {
+    return (group + probe * TABLE_GROUP_WIDTH) & (capacity - 1);
+}
+
+void initTable(Table* table) {
+    table->count = 0;
+    table->tombstones = 0;
+    table->capacity = 0;
+    table->control = NULL;
+    table->entries = NULL;
+}
+
+void freeTable(Table* table) {
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(Entry, table->entries, table->capacity);
+    initTable(table);
+}
+
+/**
+ * @brief Finds the slot of a key.
+ * @details Keys are interned, so they are compared by identity.
+ * @param table The table to look in, with a capacity other than 0
+ * @param key The key to look for
+ * @return The index of the key's slot, or -1 if it is not in the table
+ */
+static int findSlot(Table* table, ObjString* key) {
+    uint8_t tag = hashTag(key->hash);
+    int group = firstGroup(key->hash, table->capacity);
+
+    for (int probe = 1;; probe++) {
+        const uint8_t* control = &table->control[group];
+
+        GroupMask matches = matchByte(control, tag);
+        while (matches != 0) {
+            int slot = group + nextMatch(&matches);
+            if (table->entries[slot].key == key) {
+                return slot;
+            }
+        }
+
+        // An empty slot means the key would have been inserted in this group, so it can't be in a later one.
+        if (matchByte(control, CONTROL_EMPTY) != 0) {
+            return -1;
+        }
+        group = nextGroup(group, probe, table->capacity);
+    }
+}
+
+/**
+ * @brief Finds the slot a new key should be inserted in, the first free (empty or deleted) slot of its probe sequence.
+ * @param table The table to insert in, with at least one free slot
+ * @param hash The hash of the key
+ * @return The index of the slot
+ */
+static int findFreeSlot(Table* table, uint32_t hash) {
+    int group = firstGroup(hash, table->capacity);
+
+    for (int probe = 1;; probe++) {
+        GroupMask free = matchFree(&table->control[group]);
+        if (free != 0) {
+            return group + nextMatch(&free);
+        }
+        group = nextGroup(group, probe, table->capacity);
+    }
+}
+
+/**
+ * @brief Resizes the table, re-inserting every entry and dropping the tombstones.
+ * @param table The table to resize
+ * @param capacity The new number of slots, a multiple of TABLE_GROUP_WIDTH
+ */
+static void adjustCapacity(Table* table, int capacity) {
+    uint8_t* oldControl = table->control;
+    Entry* oldEntries = table->entries;
+    int oldCapacity = table->capacity;
+
+    table->control = ALLOCATE(uint8_t, capacity);
+    table->entries = ALLOCATE(Entry, capacity);
+    table->capacity = capacity;
+    table->tombstones = 0;
+    memset(table->control, CONTROL_EMPTY, capacity);
+    for (int i = 0; i < capacity; i++) {
+        table->entries[i].key = NULL;
+        table->entries[i].value = NIL_VAL;
+    }
+
+    for (int i = 0; i < oldCapacity; i++) {
+        Entry* entry = &oldEntries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        int slot = findFreeSlot(table, entry->key->hash);
+        table->control[slot] = hashTag(entry->key->hash);
+        table->entries[slot] = *entry;
+    }
+
+    FREE_ARRAY(uint8_t, oldControl, oldCapacity);
+    FREE_ARRAY(Entry, oldEntries, oldCapacity);
+}
+
+bool tableGet(Table* table, ObjString* key, Value* value) {
+    if (table->count == 0) {
+        return false;
+    }
+
+    int slot = findSlot(table, key);
+    if (slot < 0) {
+        return false;
+    }
+
+    *value = table->entries[slot].value;
+    return true;
+}
+
+bool tableSet(Table* table, ObjString* key, Value value) {
+    if (table->capacity > 0) {
+        int slot = findSlot(table, key);
+        if (slot >= 0) {
+            table->entries[slot].value = value;
+            return false;
+        }
+    }
+
+    if (table->count + table->tombstones + 1 > table->capacity * TABLE_MAX_LOAD) {
+        // When tombstones make up most of the load, rehashing at the same size is enough to get rid of them.
+        int capacity = table->count + 1 > table->capacity * TABLE_MAX_LOAD / 2 ? GROW_CAPACITY(table->capacity) : table->capacity;
+        if (capacity < TABLE_GROUP_WIDTH) {
+            capacity = TABLE_GROUP_WIDTH;
+        }
+        adjustCapacity(table, capacity);
+    }
+
+    int slot = findFreeSlot(table, key->hash);
+    if (table->control[slot] == CONTROL_DELETED) {
+        table->tombstones--;
+    }
+    table->control[slot] = hashTag(key->hash);
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    table->count++;
+    return true;
+}
+
+bool tableDelete(Table* table, ObjString* key) {
+    if (table->count == 0) {
+        return false;
+    }
+
+    int slot = findSlot(table, key);
+    if (slot < 0) {
+        return false;
+    }
+
+    // If the group still has an empty slot, every probe sequence reaching it stopped here, so the slot can go back to empty.
+    // Otherwise some probe sequence may have gone through it, and it has to stay in the way as a tombstone.
+    int group = slot & ~(TABLE_GROUP_WIDTH - 1);
+    if (matchByte(&table->control[group], CONTROL_EMPTY) != 0) {
+        table->control[slot] = CONTROL_EMPTY;
+    } else {
+        table->control[slot] = CONTROL_DELETED;
+        table->tombstones++;
+    }
+
+    table->entries[slot].key = NULL;
+    table->entries[slot].value = NIL_VAL;
+    table->count--;
+    return true;
+}
+
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
+    if (table->count == 0) {
+        return NULL;
+    }
+
+    uint8_t tag = hashTag(hash);
+    int group = firstGroup(hash, table->capacity);
+
+    for (int probe = 1;; probe++) {
+        const uint8_t* control = &table->control[group];
+
+        GroupMask matches = matchByte(control, tag);
+        while (matches != 0) {
+            ObjString* key = table->entries[group + nextMatch(&matches)].key;
+            if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0) {
+                return key;
+            }
+        }
+
+        if (matchByte(control, CONTROL_EMPTY) != 0) {
+            return NULL;
+        }
+        group = nextGroup(group, probe, table->capacity);
+    }
+}
@@ -1,6 +1,9 @@
 #include <shared/VM.h>
 #include <shared/Debug.h>
 #include <shared/Compiler.h>
+#include <shared/Jit.h>
+#include <shared/Memory.h>
+#include <shared/Object.h>
 
 VM vm;
 
@@ -19,131 +22,508 @@ static void resetStack() {
 }
 
 void initVM() {
+    vm.stack = NULL;
+    vm.stackEnd = NULL;
     resetStack();
+    vm.objects = NULL;
+    initTable(&vm.strings);
+    vm.internLookups = 0;
+    vm.internHits = 0;
+    initTable(&vm.globalSlots);
+    initValueArray(&vm.globalValues);
+    initValueArray(&vm.globalNames);
+    vm.jitMode = JIT_OFF;
+    initHeap(&vm.heap);
+    vm.image = NULL;
 }
 
 void freeVM() {
+    FREE_ARRAY(Value, vm.stack, vm.stackEnd - vm.stack);
+    freeTable(&vm.strings);
+    freeTable(&vm.globalSlots);
+    freeValueArray(&vm.globalValues);
+    freeValueArray(&vm.globalNames);
+    freeObjects();
+    unmapImage(vm.image);
+    releasePools();
+    initVM();
+}
+
+int globalSlot(ObjString* name) {
+    Value slot;
+    if (tableGet(&vm.globalSlots, name, &slot)) {
+        return (int)AS_NUMBER(slot);
+    }
+
+    int newSlot = vm.globalValues.count;
+    writeValueArray(&vm.globalValues, UNDEFINED_VAL);
+    writeValueArray(&vm.globalNames, OBJ_VAL(name));
+    tableSet(&vm.globalSlots, name, NUMBER_VAL(newSlot));
+    return newSlot;
+}
+
+InternStats internStats() {
+    InternStats stats;
+    stats.count = 0;
+    stats.capacity = vm.strings.capacity;
+    stats.tableBytes = sizeof(Entry) * vm.strings.capacity;
+    stats.stringBytes = 0;
+    stats.lookups = vm.internLookups;
+    stats.hits = vm.internHits;
+
+    for (int i = 0; i < vm.strings.capacity; i++) {
+        ObjString* string = vm.strings.entries[i].key;
+        if (string == NULL) {
+            continue;
+        }
+        stats.count++;
+        stats.stringBytes += sizeof(ObjString) + string->length + 1;
+    }
+    return stats;
 }
 
 /**
- * @brief Throws a runtime error with the given message. Prints the error message and the line of the error.
+ * @brief Prints a runtime error and the line it happened on, then resets the stack.
+ * @param line The line to report
  * @param format The error message
- * @param ... The arguments to the error message
+ * @param args The arguments to the error message
  */
-static void runtimeError(const char* format, ...) {
-    va_list args;
-    va_start(args, format);
+static void reportRuntimeError(int line, const char* format, va_list args) {
     vfprintf(stderr, format, args);
-    va_end(args);
     fputs("\n", stderr);
-
-    size_t instruction = vm.ip - vm.chunk->code - 1;
-    int line = vm.chunk->lines[instruction];
     fprintf(stderr, "[line %d] in script\n", line);
     resetStack();
 }
 
-/**
- * @brief Checks if a Value is falsey. A Value is falsey if it is nil or false.
- * @param value The Value to check
- * @return Whether the Value is falsey
- */
-static bool isFalsey(Value value) {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+void runtimeError(const char* format, ...) {
+    // Errors raised before the first instruction runs (ip at the start of the chunk) are reported on the first line.
+    int instruction = (int)(vm.ip - vm.chunk->code) - 1;
+    int line = getLine(vm.chunk, instruction < 0 ? 0 : instruction);
+
+    va_list args;
+    va_start(args, format);
+    reportRuntimeError(line, format, args);
+    va_end(args);
+}
+
+void runtimeErrorAt(int line, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    reportRuntimeError(line, format, args);
+    va_end(args);
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+/// @brief Prints the current stack contents and the instruction about to be executed.
+static void traceExecution() {
+    printf("          ");
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+    disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+}
+#endif
+
+/// @brief Pops two strings (flat or ropes) off the stack and pushes their concatenation. Long results are left as ropes, see concatenateLazy().
+static void concatenate() {
+    gcSafePoint();
+    Obj* b = AS_OBJ(pop());
+    Obj* a = AS_OBJ(pop());
+    push(OBJ_VAL(concatenateLazy(a, b)));
 }
 
+// Labels-as-values are a GNU extension, so -pedantic has to be silenced for the threaded dispatch.
+#ifdef COMPUTED_GOTO
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
 /**
  * @brief Runs the Virtual Machine. Executes each instruction in the Chunk.
+ * @details With COMPUTED_GOTO, the switch is only used to dispatch the first instruction. Every handler then jumps straight to the next one through a table of label addresses,
+ * giving each instruction its own indirect branch instead of sharing the single one at the top of the switch.
  * @return The result of running the Virtual Machine.
  */
 static InterpretResult run() {
-#define READ_BYTE() (*vm.ip++)
+#ifdef COMPUTED_GOTO
+    // Every handler carries its own copy of the dispatch code, so keep ip in a register instead of going through vm.ip on each instruction.
+    // vm.ip is only brought up to date when something outside of run() needs it.
+    uint8_t* ip = vm.ip;
+    #define READ_BYTE() (*ip++)
+    #define SYNC_IP() (vm.ip = ip)
+    #define QUICKEN(opcode) (ip[-1] = (opcode))
+    #define DEOPTIMIZE(opcode) (ip[-1] = (opcode), ip--)
+#else
+    #define READ_BYTE() (*vm.ip++)
+    #define SYNC_IP() ((void)0)
+    #define QUICKEN(opcode) (vm.ip[-1] = (opcode))
+    #define DEOPTIMIZE(opcode) (vm.ip[-1] = (opcode), vm.ip--)
+#endif
+// Quickening: a generic instruction that finds numbers on the stack rewrites itself, in the chunk, into a variant specialized for numbers (QUICKEN).
+// The variant only guards its operand types, and when the guard fails, it rewrites itself back and steps back to run the generic instruction (DEOPTIMIZE).
+// Both have no operands, so the rewrite is a single byte and the layout of the code never changes.
 #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-#define BINARY_OP(valueType, op)                          \
+#define UNDEFINED_VARIABLE(slot)                                                           \
+    do {                                                                                   \
+        SYNC_IP();                                                                         \
+        runtimeError("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot])); \
+        return INTERPRET_RUNTIME_ERROR;                                                    \
+    } while (false)
+#define BINARY_OP(valueType, op, quickened)               \
     do {                                                  \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            SYNC_IP();                                    \
             runtimeError("Operands must be numbers.");    \
             return INTERPRET_RUNTIME_ERROR;               \
         }                                                 \
+        QUICKEN(quickened);                               \
         double b = AS_NUMBER(pop());                      \
         double a = AS_NUMBER(pop());                      \
         push(valueType(a op b));                          \
     } while (false)
+// Fused "a op b" followed by OP_NOT. Not the same as the opposite comparison, !(a < b) and a >= b differ when NaN is involved.
+#define NOT_BINARY_OP(op, quickened)                      \
+    do {                                                  \
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            SYNC_IP();                                    \
+            runtimeError("Operands must be numbers.");    \
+            return INTERPRET_RUNTIME_ERROR;               \
+        }                                                 \
+        QUICKEN(quickened);                               \
+        double b = AS_NUMBER(pop());                      \
+        double a = AS_NUMBER(pop());                      \
+        push(BOOL_VAL(!(a op b)));                        \
+    } while (false)
+// Quickened "a op b", on operands already known to be numbers. The result overwrites the left operand in place.
+#define NUMBER_OP(valueType, op)                                       \
+    do {                                                               \
+        double b = AS_NUMBER(vm.stackTop[-1]);                         \
+        vm.stackTop--;                                                 \
+        vm.stackTop[-1] = valueType(AS_NUMBER(vm.stackTop[-1]) op b); \
+    } while (false)
+// Quickened version of NOT_BINARY_OP().
+#define NOT_NUMBER_OP(op)                                                \
+    do {                                                                 \
+        double b = AS_NUMBER(vm.stackTop[-1]);                           \
+        vm.stackTop--;                                                   \
+        vm.stackTop[-1] = BOOL_VAL(!(AS_NUMBER(vm.stackTop[-1]) op b)); \
+    } while (false)
+// Fused OP_CONSTANT followed by an arithmetic instruction. The optimizer only fuses number constants, so only the other operand needs checking.
+// The error message is the one the unfused instruction would have reported, OP_ADD also accepts strings.
+#define CONSTANT_OP(op, message)               \
+    do {                                       \
+        double b = AS_NUMBER(READ_CONSTANT()); \
+        if (!IS_NUMBER(peek(0))) {             \
+            SYNC_IP();                         \
+            runtimeError(message);             \
+            return INTERPRET_RUNTIME_ERROR;    \
+        }                                      \
+        double a = AS_NUMBER(pop());           \
+        push(NUMBER_VAL(a op b));              \
+    } while (false)
 
-    for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+    #define TRACE_EXECUTION() \
+        do {                  \
+            SYNC_IP();        \
+            traceExecution(); \
+        } while (false)
+#else
+    #define TRACE_EXECUTION() ((void)0)
+#endif
+
+#ifdef COMPUTED_GOTO
+    static void* dispatchTable[] = {
+    #define OPCODE_LABEL(name, operandBytes, stackEffect) [name] = &&do_##name,
+        FOR_EACH_OPCODE(OPCODE_LABEL)
+    #undef OPCODE_LABEL
+    };
+
+    #define CASE(opcode) \
+        do_##opcode:     \
+        case opcode:
+    #define DISPATCH()                        \
+        do {                                  \
+            TRACE_EXECUTION();                \
+            goto* dispatchTable[READ_BYTE()]; \
+        } while (false)
+#else
+    #define CASE(opcode) case opcode:
+    #define DISPATCH() break
 #endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-        case OP_CONSTANT: {
+
+    for (;;) {
+        TRACE_EXECUTION();
+        switch (READ_BYTE()) {
+        CASE(OP_CONSTANT) {
             Value constant = READ_CONSTANT();
             push(constant);
-            break;
+            DISPATCH();
         }
-        case OP_NIL: {
+        CASE(OP_CONSTANT_LONG) {
+            int index = READ_BYTE() << 16;
+            index |= READ_BYTE() << 8;
+            index |= READ_BYTE();
+            push(vm.chunk->constants.values[index]);
+            DISPATCH();
+        }
+        CASE(OP_NIL) {
             push(NIL_VAL);
-            break;
+            DISPATCH();
         }
-        case OP_TRUE: {
+        CASE(OP_TRUE) {
             push(BOOL_VAL(true));
-            break;
+            DISPATCH();
         }
-        case OP_FALSE: {
+        CASE(OP_FALSE) {
             push(BOOL_VAL(false));
-            break;
+            DISPATCH();
         }
-        case OP_EQUAL: {
+        CASE(OP_EQUAL) {
+            gcSafePoint();
             Value b = pop();
             Value a = pop();
             push(BOOL_VAL(valuesEqual(a, b)));
-            break;
+            DISPATCH();
         }
-        case OP_ADD: {
-            BINARY_OP(NUMBER_VAL, +);
-            break;
+        CASE(OP_GREATER) {
+            BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM);
+            DISPATCH();
         }
-        case OP_SUBTRACT: {
-            BINARY_OP(NUMBER_VAL, -);
-            break;
+        CASE(OP_LESS) {
+            BINARY_OP(BOOL_VAL, <, OP_LESS_NUM);
+            DISPATCH();
         }
-        case OP_MULTIPLY: {
-            BINARY_OP(NUMBER_VAL, *);
-            break;
+        CASE(OP_ADD) {
+            if (IS_ANY_STRING(peek(0)) && IS_ANY_STRING(peek(1))) {
+                concatenate();
+            } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                QUICKEN(OP_ADD_NUM_NUM);
+                double b = AS_NUMBER(pop());
+                double a = AS_NUMBER(pop());
+                push(NUMBER_VAL(a + b));
+            } else {
+                SYNC_IP();
+                runtimeError("Operands must be two numbers or two strings.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            DISPATCH();
+        }
+        CASE(OP_SUBTRACT) {
+            BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM_NUM);
+            DISPATCH();
         }
-        case OP_DIVIDE: {
-            BINARY_OP(NUMBER_VAL, /);
-            break;
+        CASE(OP_MULTIPLY) {
+            BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM_NUM);
+            DISPATCH();
         }
-        case OP_NOT: {
+        CASE(OP_DIVIDE) {
+            BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM_NUM);
+            DISPATCH();
+        }
+        CASE(OP_NOT) {
             push(BOOL_VAL(isFalsey(pop())));
-            break;
+            DISPATCH();
         }
-        case OP_NEGATE:
+        CASE(OP_NEGATE) {
             if (!IS_NUMBER(peek(0))) {
+                SYNC_IP();
                 runtimeError("Operand must be a number.");
                 return INTERPRET_RUNTIME_ERROR;
             }
+            QUICKEN(OP_NEGATE_NUM);
             push(NUMBER_VAL(-AS_NUMBER(pop())));
-            break;
-        case OP_RETURN: {
+            DISPATCH();
+        }
+        CASE(OP_NOT_EQUAL) {
+            gcSafePoint();
+            Value b = pop();
+            Value a = pop();
+            push(BOOL_VAL(!valuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_GREATER_EQUAL) {
+            NOT_BINARY_OP(<, OP_GREATER_EQUAL_NUM);
+            DISPATCH();
+        }
+        CASE(OP_LESS_EQUAL) {
+            NOT_BINARY_OP(>, OP_LESS_EQUAL_NUM);
+            DISPATCH();
+        }
+        CASE(OP_ADD_CONSTANT) {
+            CONSTANT_OP(+, "Operands must be two numbers or two strings.");
+            DISPATCH();
+        }
+        CASE(OP_SUBTRACT_CONSTANT) {
+            CONSTANT_OP(-, "Operands must be numbers.");
+            DISPATCH();
+        }
+        CASE(OP_MULTIPLY_CONSTANT) {
+            CONSTANT_OP(*, "Operands must be numbers.");
+            DISPATCH();
+        }
+        CASE(OP_DIVIDE_CONSTANT) {
+            CONSTANT_OP(/, "Operands must be numbers.");
+            DISPATCH();
+        }
+        CASE(OP_PRINT) {
+            gcSafePoint();
             printValue(pop());
             printf("\n");
+            DISPATCH();
+        }
+        CASE(OP_POP) {
+            pop();
+            DISPATCH();
+        }
+        CASE(OP_DEFINE_GLOBAL) {
+            int slot = READ_BYTE() << 8;
+            slot |= READ_BYTE();
+            globalWriteBarrier(vm.globalValues.values[slot]);
+            vm.globalValues.values[slot] = pop();
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL) {
+            int slot = READ_BYTE() << 8;
+            slot |= READ_BYTE();
+            Value value = vm.globalValues.values[slot];
+            if (IS_UNDEFINED(value)) {
+                UNDEFINED_VARIABLE(slot);
+            }
+            push(value);
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL) {
+            int slot = READ_BYTE() << 8;
+            slot |= READ_BYTE();
+            // Assignment doesn't declare, the variable has to be defined already.
+            if (IS_UNDEFINED(vm.globalValues.values[slot])) {
+                UNDEFINED_VARIABLE(slot);
+            }
+            globalWriteBarrier(vm.globalValues.values[slot]);
+            vm.globalValues.values[slot] = peek(0);
+            DISPATCH();
+        }
+        CASE(OP_ADD_NUM_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_ADD);
+                DISPATCH();
+            }
+            NUMBER_OP(NUMBER_VAL, +);
+            DISPATCH();
+        }
+        CASE(OP_SUBTRACT_NUM_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_SUBTRACT);
+                DISPATCH();
+            }
+            NUMBER_OP(NUMBER_VAL, -);
+            DISPATCH();
+        }
+        CASE(OP_MULTIPLY_NUM_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_MULTIPLY);
+                DISPATCH();
+            }
+            NUMBER_OP(NUMBER_VAL, *);
+            DISPATCH();
+        }
+        CASE(OP_DIVIDE_NUM_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_DIVIDE);
+                DISPATCH();
+            }
+            NUMBER_OP(NUMBER_VAL, /);
+            DISPATCH();
+        }
+        CASE(OP_GREATER_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_GREATER);
+                DISPATCH();
+            }
+            NUMBER_OP(BOOL_VAL, >);
+            DISPATCH();
+        }
+        CASE(OP_LESS_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_LESS);
+                DISPATCH();
+            }
+            NUMBER_OP(BOOL_VAL, <);
+            DISPATCH();
+        }
+        CASE(OP_GREATER_EQUAL_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_GREATER_EQUAL);
+                DISPATCH();
+            }
+            NOT_NUMBER_OP(<);
+            DISPATCH();
+        }
+        CASE(OP_LESS_EQUAL_NUM) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                DEOPTIMIZE(OP_LESS_EQUAL);
+                DISPATCH();
+            }
+            NOT_NUMBER_OP(>);
+            DISPATCH();
+        }
+        CASE(OP_NEGATE_NUM) {
+            if (!IS_NUMBER(peek(0))) {
+                DEOPTIMIZE(OP_NEGATE);
+                DISPATCH();
+            }
+            vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));
+            DISPATCH();
+        }
+        CASE(OP_RETURN) {
+            // Exit interpreter.
             return INTERPRET_OK;
         }
         }
     }
 
 #undef READ_BYTE
+#undef SYNC_IP
 #undef READ_CONSTANT
+#undef UNDEFINED_VARIABLE
+#undef QUICKEN
+#undef DEOPTIMIZE
 #undef BINARY_OP
+#undef NOT_BINARY_OP
+#undef NUMBER_OP
+#undef NOT_NUMBER_OP
+#undef CONSTANT_OP
+#undef TRACE_EXECUTION
+#undef CASE
+#undef DISPATCH
+}
+
+#ifdef COMPUTED_GOTO
+    #pragma GCC diagnostic pop
+#endif
+
+/**
+ * @brief Runs vm.chunk from the start, as native code once the JIT has translated it, with run() otherwise.
+ * @return The result of running the chunk.
+ */
+static InterpretResult runChunk() {
+    Chunk* chunk = vm.chunk;
+    chunk->invocations++;
+
+    // Translation is only tried once, when the chunk gets hot. A chunk the JIT cannot translate stays interpreted.
+    int threshold = vm.jitMode == JIT_ALWAYS ? 1 : JIT_THRESHOLD;
+    if (vm.jitMode != JIT_OFF && chunk->invocations == threshold) {
+        chunk->jit = compileJit(chunk);
+    }
+
+    if (chunk->jit != NULL) {
+        return runJit(chunk->jit) ? INTERPRET_OK : INTERPRET_RUNTIME_ERROR;
+    }
+    return run();
 }
 
 InterpretResult interpret(const char* source) {
@@ -155,16 +535,54 @@ InterpretResult interpret(const char* source) {
         return INTERPRET_COMPILE_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
-
-    InterpretResult result = run();
+    InterpretResult result = interpretChunk(&chunk);
 
     freeChunk(&chunk);
     return result;
 }
 
+InterpretResult interpretChunk(Chunk* chunk) {
+    vm.chunk = chunk;
+    vm.ip = vm.chunk->code;
+
+    // The compiler worked out how deep the stack can get, so making room once here means run() never has to check.
+    if (!reserveStack(chunk->maxStack)) {
+        runtimeError("Stack overflow.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return runChunk();
+}
+
+bool reserveStack(int count) {
+    int capacity = (int)(vm.stackEnd - vm.stack);
+    int depth = (int)(vm.stackTop - vm.stack);
+
+    if (depth + count <= capacity) {
+        return true;
+    }
+    if (depth + count > STACK_MAX) {
+        return false;
+    }
+
+    int newCapacity = capacity;
+    while (newCapacity < depth + count) {
+        newCapacity = GROW_CAPACITY(newCapacity);
+    }
+    if (newCapacity > STACK_MAX) {
+        newCapacity = STACK_MAX;
+    }
+
+    vm.stack = GROW_ARRAY(Value, vm.stack, capacity, newCapacity);
+    vm.stackTop = vm.stack + depth;
+    vm.stackEnd = vm.stack + newCapacity;
+    return true;
+}
+
 void push(Value value) {
+#ifdef DEBUG_STACK_CHECK
+    assert(vm.stackTop - vm.stack < vm.chunk->maxStack && "Stack deeper than the compiler computed.");
+#endif
     *vm.stackTop = value;
     vm.stackTop++;
 }
@@ -1,7 +1,16 @@
 #include <shared/Value.h>
 #include <shared/Memory.h>
+#include <shared/Object.h>
 
 bool valuesEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    // NaN is not equal to itself, so numbers still need an actual floating point comparison.
+    // Everything else, interned strings included, is equal only if it has the exact same bits. Except ropes, which are not interned until flattened.
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    return a == b || ((IS_ROPE(a) || IS_ROPE(b)) && stringsEqual(a, b));
+#else
     if (a.type != b.type) {
         return false;
     }
@@ -13,9 +22,13 @@ bool valuesEqual(Value a, Value b) {
         return true;
     case VAL_NUMBER:
         return AS_NUMBER(a) == AS_NUMBER(b);
+    case VAL_OBJ:
+        // Strings are interned, so equal strings are the same object. Ropes are not interned until flattened.
+        return AS_OBJ(a) == AS_OBJ(b) || ((IS_ROPE(a) || IS_ROPE(b)) && stringsEqual(a, b));
     default:
         return false; // Unreachable.
     }
+#endif
 }
 
 void initValueArray(ValueArray* array) {
@@ -0,0 +1,107 @@
+#include <inttypes.h>
+#include <time.h>
+#include <shared/common.h>
+#include <shared/Memory.h>
+#include <shared/Object.h>
+#include <shared/VM.h>
+
+/// @brief Depth of the tree kept alive for the whole run, 2^depth leaves. Big enough for the old generation to need major collections.
+#define LONG_LIVED_DEPTH 16
+
+/// @brief Depth of the trees built and dropped right away.
+#define SHORT_LIVED_DEPTH 12
+
+/// @brief Number of short-lived trees built per run.
+#define SHORT_LIVED_TREES 200
+
+/**
+ * @brief Gets the current time, for measuring.
+ * @return The time in seconds
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Builds a binary tree of ropes on top of the stack, the way a Lox program concatenating strings would: objects only live on the stack, and
+ * every allocation comes after a safe point. Leaves are distinct strings, long enough for every node to be a rope.
+ * @param depth The depth of the tree
+ * @param leaf Numbers the leaves, incremented for each one
+ */
+static void buildTree(int depth, int* leaf) {
+    gcSafePoint();
+    if (depth == 0) {
+        char chars[96];
+        int length = snprintf(chars, sizeof(chars), "leaf %08d of a binary tree of ropes, padded to be longer than the shortest rope", (*leaf)++);
+        *vm.stackTop++ = OBJ_VAL(copyString(chars, length));
+        return;
+    }
+
+    buildTree(depth - 1, leaf);
+    buildTree(depth - 1, leaf);
+    // The collection can move both halves, so they are read from the stack after it.
+    gcSafePoint();
+    Obj* right = AS_OBJ(*--vm.stackTop);
+    Obj* left = AS_OBJ(*--vm.stackTop);
+    *vm.stackTop++ = OBJ_VAL(concatenateLazy(left, right));
+}
+
+/**
+ * @brief Runs the benchmark in a fresh VM with a pause-time target, and prints its pauses.
+ * @param pauseMicros The pause-time target of major collections, 0 for stop-the-world
+ * @param concurrent Whether the old generation is marked on a background thread
+ */
+static void benchmark(int pauseMicros, bool concurrent) {
+    initVM();
+    vm.heap.pauseNanoseconds = (uint64_t)pauseMicros * 1000;
+    vm.heap.concurrent = concurrent;
+    reserveStack(LONG_LIVED_DEPTH + 2);
+    int leaf = 0;
+
+    double start = now();
+    buildTree(LONG_LIVED_DEPTH, &leaf);
+    int slot = globalSlot(copyString("longLived", 9));
+    globalWriteBarrier(vm.globalValues.values[slot]);
+    vm.globalValues.values[slot] = *--vm.stackTop;
+
+    for (int tree = 0; tree < SHORT_LIVED_TREES; tree++) {
+        buildTree(SHORT_LIVED_DEPTH, &leaf);
+        vm.stackTop--;
+    }
+    double time = now() - start;
+
+    GcStats* stats = &vm.heap.stats;
+    char budget[16];
+    snprintf(budget, sizeof(budget), pauseMicros == 0 ? "stw" : "%d us", pauseMicros);
+    printf("%8s %8s %8.3f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10.3f\n", budget, concurrent ? "thread" : "main", time, stats->majorCollections, stats->majorSlices,
+           stats->pauses, pausePercentile(stats, 50), pausePercentile(stats, 99), stats->maxPauseNanoseconds / 1e6);
+    freeVM();
+}
+
+/**
+ * @brief Runs the benchmark with a pause-time target, marking on the main thread, then on a background thread if the build supports it.
+ * @param pauseMicros The pause-time target of major collections, 0 for stop-the-world
+ */
+static void benchmarkMarkers(int pauseMicros) {
+    benchmark(pauseMicros, false);
+    if (concurrentMarkingSupported()) {
+        benchmark(pauseMicros, true);
+    }
+}
+
+int main(int argc, const char** argv) {
+    printf("%8s %8s %8s %8s %8s %8s %8s %8s %10s\n", "budget", "marking", "time s", "majors", "slices", "pauses", "p50 us", "p99 us", "max ms");
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            benchmarkMarkers(atoi(argv[i]));
+        }
+    } else {
+        int budgets[] = { 0, 1000, 200, 50 };
+        for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+            benchmarkMarkers(budgets[i]);
+        }
+    }
+    return 0;
+}
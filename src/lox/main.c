@@ -1,7 +1,10 @@
+#include <inttypes.h>
 #include <sysexits.h>
 #include <shared/common.h>
+#include <shared/Bytecode.h>
 #include <shared/Chunk.h>
 #include <shared/Debug.h>
+#include <shared/Image.h>
 #include <shared/VM.h>
 
 /// @brief Main REPL loop.
@@ -56,32 +59,146 @@ static char* readFile(const char* path) {
 }
 
 /**
- * @brief Interprets and runs a file of Lox code, given a path.
+ * @brief Interprets and runs a file of Lox code, or of bytecode compiled by loxc if its name ends with ".loxb", given a path.
  * @param path The path to the file.
+ * @return The exit code: 0, EX_NOINPUT if the file does not compile or load, or EX_SOFTWARE after a runtime error.
  */
-static void runFile(const char* path) {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+static int runFile(const char* path) {
+    InterpretResult result;
+    size_t length = strlen(path);
+    if (length > 5 && strcmp(path + length - 5, ".loxb") == 0) {
+        Chunk chunk;
+        initChunk(&chunk);
+        if (!loadBytecode(path, &chunk)) {
+            freeChunk(&chunk);
+            return EX_NOINPUT;
+        }
+        result = interpretChunk(&chunk);
+        freeChunk(&chunk);
+    } else {
+        char* source = readFile(path);
+        result = interpret(source);
+        free(source);
+    }
 
     if (result == INTERPRET_COMPILE_ERROR)
-        exit(EX_NOINPUT);
+        return EX_NOINPUT;
     if (result == INTERPRET_RUNTIME_ERROR)
-        exit(EX_SOFTWARE);
+        return EX_SOFTWARE;
+    return 0;
+}
+
+/// @brief Prints how to use the program and exits.
+static void usage() {
+    fprintf(stderr, "Usage: lox [--jit=off|on|always] [--image image] [--save-image image] [--gc-stats] [--gc-pause-us=microseconds] [--gc-concurrent=off|on] [--gc-stress] [path]\n");
+    exit(EX_USAGE);
+}
+
+/**
+ * @brief Parses the value of the --jit option.
+ * @param value The text after "--jit=".
+ * @return The JIT mode it names.
+ */
+static JitMode parseJitMode(const char* value) {
+    if (strcmp(value, "off") == 0)
+        return JIT_OFF;
+    if (strcmp(value, "on") == 0)
+        return JIT_ON;
+    if (strcmp(value, "always") == 0)
+        return JIT_ALWAYS;
+    usage();
+    return JIT_OFF;
+}
+
+/**
+ * @brief Parses the value of the --gc-pause-us option.
+ * @param value The text after "--gc-pause-us=".
+ * @return The pause-time target in nanoseconds, 0 for stop-the-world major collections.
+ */
+static uint64_t parsePause(const char* value) {
+    char* end;
+    long long micros = strtoll(value, &end, 10);
+    if (end == value || *end != '\0' || micros < 0) {
+        usage();
+    }
+    return (uint64_t)micros * 1000;
+}
+
+/// @brief Prints the statistics of the garbage collector, for --gc-stats.
+static void printGcStats() {
+    GcStats* stats = &vm.heap.stats;
+    double minorAverage = stats->minorCollections == 0 ? 0 : (double)stats->minorNanoseconds / stats->minorCollections;
+    double majorAverage = stats->majorSlices == 0 ? 0 : (double)stats->majorNanoseconds / stats->majorSlices;
+    double survival = stats->nurseryBytes == 0 ? 0 : 100.0 * stats->promotedBytes / stats->nurseryBytes;
+    fprintf(stderr, "[gc] minor: %" PRIu64 " collections, pause avg %.3f ms, max %.3f ms, survival %.1f%% (%" PRIu64 " of %" PRIu64 " bytes)\n",
+            stats->minorCollections, minorAverage / 1e6, stats->minorMaxNanoseconds / 1e6, survival, stats->promotedBytes, stats->nurseryBytes);
+    fprintf(stderr, "[gc] major: %" PRIu64 " collections in %" PRIu64 " slices, slice avg %.3f ms, max %.3f ms, old generation %zu bytes\n",
+            stats->majorCollections, stats->majorSlices, majorAverage / 1e6, stats->majorMaxNanoseconds / 1e6, vm.heap.oldBytes);
+    fprintf(stderr, "[gc] pauses: %" PRIu64 ", p50 <= %" PRIu64 " us, p99 <= %" PRIu64 " us, max %.3f ms\n", stats->pauses, pausePercentile(stats, 50),
+            pausePercentile(stats, 99), stats->maxPauseNanoseconds / 1e6);
+    for (int bucket = 0; bucket < GC_PAUSE_BUCKETS; bucket++) {
+        if (stats->pauseHistogram[bucket] != 0) {
+            fprintf(stderr, "[gc]   < %" PRIu64 " us: %" PRIu64 "\n", (uint64_t)1 << bucket, stats->pauseHistogram[bucket]);
+        }
+    }
 }
 
 int main(int argc, const char** argv) {
     initVM();
 
-    if (argc) {
+    // Options come before the path.
+    const char* imagePath = NULL;
+    const char* saveImagePath = NULL;
+    bool gcStats = false;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strncmp(argv[arg], "--jit=", 6) == 0) {
+            vm.jitMode = parseJitMode(argv[arg] + 6);
+            if (vm.jitMode != JIT_OFF && !jitSupported()) {
+                fprintf(stderr, "The JIT is not supported by this build, falling back to the interpreter.\n");
+            }
+        } else if (strcmp(argv[arg], "--image") == 0 && arg + 1 < argc) {
+            imagePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--save-image") == 0 && arg + 1 < argc) {
+            saveImagePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--gc-stats") == 0) {
+            gcStats = true;
+        } else if (strncmp(argv[arg], "--gc-pause-us=", 14) == 0) {
+            vm.heap.pauseNanoseconds = parsePause(argv[arg] + 14);
+        } else if (strcmp(argv[arg], "--gc-concurrent=on") == 0 || strcmp(argv[arg], "--gc-concurrent=off") == 0) {
+            vm.heap.concurrent = strcmp(argv[arg] + 16, "on") == 0;
+            if (vm.heap.concurrent && !concurrentMarkingSupported()) {
+                fprintf(stderr, "Concurrent marking is not supported by this build, marking on the main thread.\n");
+            }
+        } else if (strcmp(argv[arg], "--gc-stress") == 0) {
+            vm.heap.stress = true;
+        } else {
+            usage();
+        }
+    }
+
+    // The image has to be loaded into the fresh VM, before anything is interned.
+    if (imagePath != NULL && !loadImage(imagePath)) {
+        exit(EX_NOINPUT);
+    }
+
+    int status = 0;
+    if (arg == argc) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
+    } else if (arg == argc - 1) {
+        status = runFile(argv[arg]);
     } else {
-        fprintf(stderr, "Usage: lox [path]\n");
-        exit(EX_USAGE);
+        usage();
     }
 
+    // Only saved if the program ran without errors, so the image is a checkpoint of a successful run.
+    if (status == 0 && saveImagePath != NULL && !saveImage(saveImagePath)) {
+        status = EX_CANTCREAT;
+    }
+
+    if (gcStats) {
+        printGcStats();
+    }
     freeVM();
-    return 0;
+    return status;
 }
@@ -0,0 +1,326 @@
+#include <inttypes.h>
+#include <math.h>
+#include <sysexits.h>
+#include <shared/args.h>
+#include <shared/common.h>
+#include <shared/Bytecode.h>
+#include <shared/Chunk.h>
+#include <shared/Compiler.h>
+#include <shared/Object.h>
+#include <shared/VM.h>
+
+/// @brief Number of instructions written to each C function. The program is split in many functions to keep C compile times reasonable.
+#define INSTRUCTIONS_PER_FUNCTION 256
+
+/**
+ * @brief Reads a file and returns its contents.
+ * @param path The path to the file.
+ * @return The contents of the file.
+ */
+static char* readFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(EX_IOERR);
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t fileSize = ftell(file);
+    rewind(file);
+
+    char* buffer = (char*)malloc(fileSize + 1); // +1 for null terminator.
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        exit(EX_IOERR);
+    }
+
+    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+
+    if (bytesRead < fileSize) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(EX_IOERR);
+    }
+
+    buffer[bytesRead] = '\0';
+
+    fclose(file);
+    return buffer;
+}
+
+/**
+ * @brief Writes characters as a C string literal.
+ * @param out The file to write to
+ * @param chars The characters
+ * @param length The number of characters
+ */
+static void writeStringLiteral(FILE* out, const char* chars, int length) {
+    fputc('"', out);
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        // '?' is escaped too, so that no trigraph can sneak in.
+        if (c == '"' || c == '\\' || c == '?') {
+            fprintf(out, "\\%c", c);
+        } else if (c >= ' ' && c <= '~') {
+            fputc(c, out);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Writes a constant as a C expression of type Value.
+ * @param out The file to write to
+ * @param value The constant
+ * @return false if the constant has a type that cannot be written.
+ */
+static bool writeValue(FILE* out, Value value) {
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        if (isfinite(number)) {
+            // Hexadecimal floating point round-trips exactly.
+            fprintf(out, "NUMBER_VAL(%a)", number);
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            fprintf(out, "NUMBER_VAL(aotDouble(0x%016" PRIx64 "u))", bits);
+        }
+    } else if (IS_BOOL(value)) {
+        fprintf(out, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NIL(value)) {
+        fprintf(out, "NIL_VAL");
+    } else if (IS_STRING(value)) {
+        ObjString* string = AS_STRING(value);
+        fprintf(out, "OBJ_VAL(copyString(");
+        writeStringLiteral(out, string->chars, string->length);
+        fprintf(out, ", %d))", string->length);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the AotLoader of a program: its constants, in Constant Pool order, and its globals, in slot order, so indexes and slots are the same as at compile time.
+ * @param out The file to write to
+ * @param chunk The compiled program
+ * @return false if a constant cannot be written.
+ */
+static bool writeLoader(FILE* out, Chunk* chunk) {
+    fprintf(out, "static void load(Chunk* chunk) {\n");
+    fprintf(out, "    chunk->maxStack = %d;\n", chunk->maxStack);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        fprintf(out, "    writeValueArray(&chunk->constants, ");
+        if (!writeValue(out, chunk->constants.values[i])) {
+            return false;
+        }
+        fprintf(out, ");\n");
+    }
+    for (int slot = 0; slot < vm.globalNames.count; slot++) {
+        ObjString* name = AS_STRING(vm.globalNames.values[slot]);
+        fprintf(out, "    globalSlot(copyString(");
+        writeStringLiteral(out, name->chars, name->length);
+        fprintf(out, ", %d));\n", name->length);
+    }
+    fprintf(out, "}\n\n");
+    return true;
+}
+
+/**
+ * @brief Writes one instruction as a statement of the AotScript, or of one of the functions it is split in.
+ * @param out The file to write to
+ * @param chunk The compiled program
+ * @param offset The offset of the instruction
+ */
+static void writeInstruction(FILE* out, Chunk* chunk, int offset) {
+    uint8_t* operands = chunk->code + offset + 1;
+    int line = getLine(chunk, offset);
+
+    fprintf(out, "    ");
+    // Quickened instructions are only written by run(), but they would mean the same as their generic versions.
+    switch ((OpCode)chunk->code[offset]) {
+    case OP_CONSTANT:
+        fprintf(out, "AOT_CONSTANT(%d);", operands[0]);
+        break;
+    case OP_CONSTANT_LONG:
+        fprintf(out, "AOT_CONSTANT(%d);", (operands[0] << 16) | (operands[1] << 8) | operands[2]);
+        break;
+    case OP_NIL:
+        fprintf(out, "AOT_NIL();");
+        break;
+    case OP_TRUE:
+        fprintf(out, "AOT_TRUE();");
+        break;
+    case OP_FALSE:
+        fprintf(out, "AOT_FALSE();");
+        break;
+    case OP_EQUAL:
+        fprintf(out, "AOT_EQUAL(false);");
+        break;
+    case OP_NOT_EQUAL:
+        fprintf(out, "AOT_EQUAL(true);");
+        break;
+    case OP_GREATER:
+    case OP_GREATER_NUM:
+        fprintf(out, "AOT_BINARY(BOOL_VAL, >, %d);", line);
+        break;
+    case OP_LESS:
+    case OP_LESS_NUM:
+        fprintf(out, "AOT_BINARY(BOOL_VAL, <, %d);", line);
+        break;
+    case OP_GREATER_EQUAL:
+    case OP_GREATER_EQUAL_NUM:
+        fprintf(out, "AOT_NOT_BINARY(<, %d);", line);
+        break;
+    case OP_LESS_EQUAL:
+    case OP_LESS_EQUAL_NUM:
+        fprintf(out, "AOT_NOT_BINARY(>, %d);", line);
+        break;
+    case OP_ADD:
+    case OP_ADD_NUM_NUM:
+        fprintf(out, "AOT_ADD(%d);", line);
+        break;
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NUM_NUM:
+        fprintf(out, "AOT_BINARY(NUMBER_VAL, -, %d);", line);
+        break;
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NUM_NUM:
+        fprintf(out, "AOT_BINARY(NUMBER_VAL, *, %d);", line);
+        break;
+    case OP_DIVIDE:
+    case OP_DIVIDE_NUM_NUM:
+        fprintf(out, "AOT_BINARY(NUMBER_VAL, /, %d);", line);
+        break;
+    case OP_ADD_CONSTANT:
+        fprintf(out, "AOT_BINARY_CONSTANT(+, %d, %d, \"Operands must be two numbers or two strings.\");", operands[0], line);
+        break;
+    case OP_SUBTRACT_CONSTANT:
+        fprintf(out, "AOT_BINARY_CONSTANT(-, %d, %d, \"Operands must be numbers.\");", operands[0], line);
+        break;
+    case OP_MULTIPLY_CONSTANT:
+        fprintf(out, "AOT_BINARY_CONSTANT(*, %d, %d, \"Operands must be numbers.\");", operands[0], line);
+        break;
+    case OP_DIVIDE_CONSTANT:
+        fprintf(out, "AOT_BINARY_CONSTANT(/, %d, %d, \"Operands must be numbers.\");", operands[0], line);
+        break;
+    case OP_NOT:
+        fprintf(out, "AOT_NOT();");
+        break;
+    case OP_NEGATE:
+    case OP_NEGATE_NUM:
+        fprintf(out, "AOT_NEGATE(%d);", line);
+        break;
+    case OP_PRINT:
+        fprintf(out, "AOT_PRINT();");
+        break;
+    case OP_POP:
+        fprintf(out, "AOT_POP();");
+        break;
+    case OP_DEFINE_GLOBAL:
+        fprintf(out, "AOT_DEFINE_GLOBAL(%d);", (operands[0] << 8) | operands[1]);
+        break;
+    case OP_GET_GLOBAL:
+        fprintf(out, "AOT_GET_GLOBAL(%d, %d);", (operands[0] << 8) | operands[1], line);
+        break;
+    case OP_SET_GLOBAL:
+        fprintf(out, "AOT_SET_GLOBAL(%d, %d);", (operands[0] << 8) | operands[1], line);
+        break;
+    case OP_RETURN:
+        fprintf(out, "AOT_RETURN();");
+        break;
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * @brief Writes a compiled program as a C file that runs it through the shared runtime.
+ * @param out The file to write to
+ * @param chunk The compiled program
+ * @param sourcePath The path of the Lox source, for the header comment
+ * @return false if the program cannot be written.
+ */
+static bool writeProgram(FILE* out, Chunk* chunk, const char* sourcePath) {
+    fprintf(out, "// Compiled by loxc from %s.\n", sourcePath);
+    fprintf(out, "// Build against lib/shared/include and link with libshared, using the same Value representation as loxc.\n");
+    fprintf(out, "#include <shared/Aot.h>\n\n");
+#ifdef NAN_BOXING
+    fprintf(out, "#ifndef NAN_BOXING\n    #error \"Compiled for NaN-boxed Values, define NAN_BOXING\"\n#endif\n\n");
+#else
+    fprintf(out, "#ifdef NAN_BOXING\n    #error \"Compiled for tagged union Values, do not define NAN_BOXING\"\n#endif\n\n");
+#endif
+
+    if (!writeLoader(out, chunk)) {
+        return false;
+    }
+
+    // One function for the whole program would be the simplest, but C compilers slow down badly (or run out of memory) optimizing huge functions.
+    int parts = 0;
+    int offset = 0;
+    while (offset < chunk->count) {
+        fprintf(out, "static InterpretResult part%d(Value** top, Value* k) {\n    Value* sp = *top;\n", parts++);
+        for (int i = 0; i < INSTRUCTIONS_PER_FUNCTION && offset < chunk->count; i++) {
+            writeInstruction(out, chunk, offset);
+            offset += instructionLength(chunk, offset);
+        }
+        fprintf(out, "    *top = sp;\n    return INTERPRET_OK;\n}\n\n");
+    }
+
+    fprintf(out, "static InterpretResult script(Value* sp, Value* k) {\n");
+    for (int i = 0; i < parts; i++) {
+        fprintf(out, "    if (part%d(&sp, k) != INTERPRET_OK)\n        return INTERPRET_RUNTIME_ERROR;\n", i);
+    }
+    fprintf(out, "    return INTERPRET_OK;\n}\n\n");
+
+    fprintf(out, "int main(void) {\n    return runAot(load, script);\n}\n");
+    return true;
+}
+
+int main(int argc, const char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: loxc <input.lox> <output.c|output.loxb>\n");
+        exit(EX_USAGE);
+    }
+
+    initVM();
+
+    char* source = readFile(argv[INPUT_ARG]);
+    Chunk chunk;
+    initChunk(&chunk);
+    bool compiled = compile(source, &chunk);
+    free(source);
+    if (!compiled) {
+        exit(EX_NOINPUT);
+    }
+
+    // A .loxb output skips C altogether: lox runs it directly.
+    size_t length = strlen(argv[OUTPUT_ARG]);
+    if (length > 5 && strcmp(argv[OUTPUT_ARG] + length - 5, ".loxb") == 0) {
+        if (!saveBytecode(&chunk, argv[OUTPUT_ARG])) {
+            exit(EX_CANTCREAT);
+        }
+        freeChunk(&chunk);
+        freeVM();
+        return 0;
+    }
+
+    FILE* out = fopen(argv[OUTPUT_ARG], "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", argv[OUTPUT_ARG]);
+        exit(EX_CANTCREAT);
+    }
+    if (!writeProgram(out, &chunk, argv[INPUT_ARG])) {
+        fprintf(stderr, "Could not compile a constant of \"%s\" to C.\n", argv[INPUT_ARG]);
+        fclose(out);
+        exit(EX_SOFTWARE);
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Could not write file \"%s\".\n", argv[OUTPUT_ARG]);
+        exit(EX_IOERR);
+    }
+
+    freeChunk(&chunk);
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <time.h>
+#include <shared/common.h>
+#include <shared/Memory.h>
+#include <shared/Object.h>
+#include <shared/Table.h>
+#include <shared/VM.h>
+
+/// @brief Number of times each benchmark goes over its keys.
+#define ROUNDS 50
+
+/**
+ * @brief Baseline hash table, open addressing with linear probing and tombstones, as lib/shared used before the Swiss table.
+ * @var LinearTable::count The number of entries in use, tombstones included
+ * @var LinearTable::capacity The number of entries allocated
+ * @var LinearTable::entries The entries of the table. A tombstone is a NULL key with a true value
+ */
+typedef struct {
+    int count;
+    int capacity;
+    Entry* entries;
+} LinearTable;
+
+/**
+ * @brief Finds the entry for a key, or the entry where it should be inserted.
+ * @param entries The entries to look in
+ * @param capacity The number of entries, a power of 2
+ * @param key The key to look for
+ * @return The entry of the key, or the empty entry (or first tombstone) where it should go
+ */
+static Entry* linearFindEntry(Entry* entries, int capacity, ObjString* key) {
+    uint32_t index = key->hash & (capacity - 1);
+    Entry* tombstone = NULL;
+
+    for (;;) {
+        Entry* entry = &entries[index];
+        if (entry->key == NULL) {
+            if (IS_NIL(entry->value)) {
+                return tombstone != NULL ? tombstone : entry;
+            }
+            if (tombstone == NULL) {
+                tombstone = entry;
+            }
+        } else if (entry->key == key) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+__attribute__((noinline)) static bool linearGet(LinearTable* table, ObjString* key, Value* value) {
+    if (table->count == 0) {
+        return false;
+    }
+
+    Entry* entry = linearFindEntry(table->entries, table->capacity, key);
+    if (entry->key == NULL) {
+        return false;
+    }
+
+    *value = entry->value;
+    return true;
+}
+
+__attribute__((noinline)) static void linearSet(LinearTable* table, ObjString* key, Value value) {
+    if (table->count + 1 > table->capacity * 0.75) {
+        int capacity = GROW_CAPACITY(table->capacity);
+        Entry* entries = ALLOCATE(Entry, capacity);
+        for (int i = 0; i < capacity; i++) {
+            entries[i].key = NULL;
+            entries[i].value = NIL_VAL;
+        }
+
+        table->count = 0;
+        for (int i = 0; i < table->capacity; i++) {
+            Entry* entry = &table->entries[i];
+            if (entry->key == NULL) {
+                continue;
+            }
+            *linearFindEntry(entries, capacity, entry->key) = *entry;
+            table->count++;
+        }
+
+        FREE_ARRAY(Entry, table->entries, table->capacity);
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+
+    Entry* entry = linearFindEntry(table->entries, table->capacity, key);
+    if (entry->key == NULL && IS_NIL(entry->value)) {
+        table->count++;
+    }
+    entry->key = key;
+    entry->value = value;
+}
+
+__attribute__((noinline)) static void linearDelete(LinearTable* table, ObjString* key) {
+    if (table->count == 0) {
+        return;
+    }
+
+    Entry* entry = linearFindEntry(table->entries, table->capacity, key);
+    if (entry->key == NULL) {
+        return;
+    }
+
+    entry->key = NULL;
+    entry->value = BOOL_VAL(true);
+}
+
+/// @brief Gets a monotonic time in seconds.
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Creates interned keys that look like Lox identifiers.
+ * @param prefix Prefix of every key, so different sets don't share keys
+ * @param count The number of keys to create
+ * @return The keys, to be freed with FREE_ARRAY
+ */
+static ObjString** makeKeys(const char* prefix, int count) {
+    ObjString** keys = ALLOCATE(ObjString*, count);
+    for (int i = 0; i < count; i++) {
+        char name[32];
+        int length = snprintf(name, sizeof(name), "%s%d", prefix, i);
+        keys[i] = copyString(name, length);
+    }
+    return keys;
+}
+
+/**
+ * @brief Runs every benchmark on a table of the given size, printing the average time per operation of both tables.
+ * @param size The number of keys in the table
+ */
+static void benchmark(int size) {
+    ObjString** keys = makeKeys("name", size);
+    ObjString** missing = makeKeys("other", size);
+    int operations = size * ROUNDS;
+    double checksum = 0;
+    Value value;
+
+    Table swiss;
+    initTable(&swiss);
+    LinearTable linear = { 0, 0, NULL };
+    for (int i = 0; i < size; i++) {
+        tableSet(&swiss, keys[i], NUMBER_VAL(i));
+        linearSet(&linear, keys[i], NUMBER_VAL(i));
+    }
+
+    double start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < size; i++) {
+            tableGet(&swiss, keys[i], &value);
+            checksum += AS_NUMBER(value);
+        }
+    }
+    double swissHit = now() - start;
+
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < size; i++) {
+            linearGet(&linear, keys[i], &value);
+            checksum += AS_NUMBER(value);
+        }
+    }
+    double linearHit = now() - start;
+
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < size; i++) {
+            checksum += tableGet(&swiss, missing[i], &value);
+        }
+    }
+    double swissMiss = now() - start;
+
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < size; i++) {
+            checksum += linearGet(&linear, missing[i], &value);
+        }
+    }
+    double linearMiss = now() - start;
+
+    // Delete and re-insert every key, the kind of churn that leaves tombstones behind.
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < size; i++) {
+            tableDelete(&swiss, keys[i]);
+            tableSet(&swiss, missing[i], NUMBER_VAL(i));
+        }
+        ObjString** swap = keys;
+        keys = missing;
+        missing = swap;
+    }
+    double swissChurn = now() - start;
+
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < size; i++) {
+            linearDelete(&linear, keys[i]);
+            linearSet(&linear, missing[i], NUMBER_VAL(i));
+        }
+        ObjString** swap = keys;
+        keys = missing;
+        missing = swap;
+    }
+    double linearChurn = now() - start;
+
+    printf("%8d  %-6s %8.2f %8.2f %8.2f\n", size, "swiss", swissHit / operations * 1e9, swissMiss / operations * 1e9, swissChurn / operations * 1e9);
+    printf("%8s  %-6s %8.2f %8.2f %8.2f\n", "", "linear", linearHit / operations * 1e9, linearMiss / operations * 1e9, linearChurn / operations * 1e9);
+    if (checksum < 0) {
+        printf("%g\n", checksum); // Keeps the lookups from being optimized away.
+    }
+
+    freeTable(&swiss);
+    FREE_ARRAY(Entry, linear.entries, linear.capacity);
+    FREE_ARRAY(ObjString*, keys, size);
+    FREE_ARRAY(ObjString*, missing, size);
+}
+
+int main(int argc, const char** argv) {
+    initVM();
+
+    printf("%8s  %-6s %8s %8s %8s   (ns per operation)\n", "keys", "table", "hit", "miss", "churn");
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            benchmark(atoi(argv[i]));
+        }
+    } else {
+        int sizes[] = { 8, 64, 1024, 16384, 262144 };
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            benchmark(sizes[i]);
+        }
+    }
+
+    freeVM();
+    return 0;
+}